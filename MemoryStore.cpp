@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include "Utilities.h"
+#include "checkpoint.h"
 
 MemoryStore::MemoryStore(uint64_t startAddr, uint64_t numEntries)
     : startAddr(startAddr) {
@@ -96,6 +97,16 @@ int MemoryStore::setMemValue(uint64_t address, uint64_t value, MemEntrySize size
     return getOrSetValue(false, address, value, size);
 }
 
+void MemoryStore::saveState(std::ostream& out) const {
+    putRaw(out, startAddr);
+    putVector(out, memArr);
+}
+
+bool MemoryStore::restoreState(std::istream& in) {
+    uint64_t savedStart;
+    return getRaw(in, savedStart) && savedStart == startAddr && getVector(in, memArr);
+}
+
 int MemoryStore::loadFromFile(const char *fileName) {
     // Open instruction file
     std::ifstream infile(fileName, std::ios::binary | std::ios::in);
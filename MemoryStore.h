@@ -1,6 +1,8 @@
 #pragma once
 #include <inttypes.h>
 
+#include <istream>
+#include <ostream>
 #include <string>
 #include <vector>
 
@@ -32,6 +34,14 @@ class MemoryStore {
     int loadFromFile(const char* fileName);
     int getMemValue(uint64_t address, uint64_t& value, MemEntrySize size);
     int setMemValue(uint64_t address, uint64_t value, MemEntrySize size);
+    // true if both stores cover the same range with identical bytes
+    bool sameContents(const MemoryStore& other) const {
+        return startAddr == other.startAddr && memArr == other.memArr;
+    }
+    // Write every byte to a checkpoint, or read them back from one
+    void saveState(std::ostream& out) const;
+    // @return false if the checkpoint holds a memory of another size
+    bool restoreState(std::istream& in);
     int printMemory(uint64_t startAddress, uint64_t endAddress);
     int printMemArray(uint64_t startAddr, uint64_t endAddr, uint64_t entrySize,
                       uint64_t entriesPerRow, std::ostream& out_stream);
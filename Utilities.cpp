@@ -354,6 +354,11 @@ static void printInstr(uint32_t curInst, StageStatus status, std::ostream &pipeS
         sb << " HALT" << stageStatusStr.at(status);
         pipeState << std::left << std::setw(25) << sb.str();
         return;
+    } else if (curInst == ROI_BEGIN_INSTRUCTION || curInst == ROI_END_INSTRUCTION) {
+        sb << (curInst == ROI_BEGIN_INSTRUCTION ? " ROI BEGIN" : " ROI END")
+           << stageStatusStr.at(status);
+        pipeState << std::left << std::setw(25) << sb.str();
+        return;
     // } else if (curInst == 0xdeefdeef) {
     //     pipeState << std::left << std::setw(25) << " UNKNOWN ";
     //     return;
@@ -396,33 +401,135 @@ static void printInstr(uint32_t curInst, StageStatus status, std::ostream &pipeS
     pipeState << std::left << std::setw(25) << sb.str();
 }
 
-Status dumpPipeState(PipeState &state, const std::string &base_output_name) {
-    static auto fileInit = false;
-    auto fileOp = std::ios::app;
-    if (!fileInit) {
-        fileOp = std::ios::out;
-        fileInit = true;
+void printPipeState(PipeState &state, std::ostream &pipe_out) {
+    pipe_out << "Cycle: " << std::right << std::setw(8) << state.cycle << "\t|";
+    pipe_out << "|";
+    printIFPC(state.ifPC, state.ifStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.idInstr, state.idStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.exInstr, state.exStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.memInstr, state.memStatus, pipe_out);
+    pipe_out << "|";
+    printInstr(state.wbInstr, state.wbStatus, pipe_out);
+    pipe_out << "|";
+}
+
+PipeStateWriter::~PipeStateWriter() {
+    close();
+}
+
+Status PipeStateWriter::open(const std::string &base_output_name, PipeTraceFormat traceFormat) {
+    close();
+    format = traceFormat;
+    lastCycle = 0;
+
+    std::string fileName = base_output_name + "_pipe_state.out";
+    auto fileOp = std::ios::out | std::ios::trunc;
+    if (format == TRACE_BINARY) {
+        fileName = base_output_name + "_pipe_state.bin";
+        fileOp |= std::ios::binary;
     }
-    std::ofstream pipe_out(base_output_name + "_pipe_state.out", fileOp);
-
-    if (pipe_out) {
-        pipe_out << "Cycle: " << std::setw(8) << state.cycle << "\t|";
-        pipe_out << "|";
-        printIFPC(state.ifPC, state.ifStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.idInstr, state.idStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.exInstr, state.exStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.memInstr, state.memStatus, pipe_out);
-        pipe_out << "|";
-        printInstr(state.wbInstr, state.wbStatus, pipe_out);
-        pipe_out << "|" << std::endl;
-        return SUCCESS;
-    } else {
+
+    // The buffer has to be installed before the file is opened to take effect
+    buffer.resize(PIPE_STATE_BUFFER_SIZE);
+    pipe_out.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    pipe_out.open(fileName, fileOp);
+    if (!pipe_out) {
         std::cerr << LOG_ERROR << "Could not open pipe state file!" << std::endl;
         return ERROR;
     }
+
+    if (format == TRACE_BINARY) {
+        PipeTraceHeader header{PIPE_TRACE_MAGIC, PIPE_TRACE_VERSION, sizeof(PipeTraceRecord)};
+        pipe_out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    }
+    return SUCCESS;
+}
+
+Status PipeStateWriter::write(PipeState &state) {
+    if (!pipe_out.is_open()) return ERROR;
+
+    if (format == TRACE_TEXT) {
+        // '\n' instead of std::endl so lines are only flushed when the buffer fills up
+        printPipeState(state, pipe_out);
+        pipe_out << '\n';
+        return pipe_out ? SUCCESS : ERROR;
+    }
+
+    // Gaps that do not fit in a record are bridged with skip records
+    uint64_t delta = state.cycle - lastCycle;
+    while (delta > PIPE_TRACE_MAX_DELTA) {
+        PipeTraceRecord skip{};
+        skip.info = PIPE_TRACE_MAX_DELTA | (PIPE_TRACE_SKIP << PIPE_TRACE_DELTA_BITS);
+        pipe_out.write(reinterpret_cast<const char *>(&skip), sizeof(skip));
+        delta -= PIPE_TRACE_MAX_DELTA;
+    }
+
+    uint32_t statuses = state.ifStatus | state.idStatus << 3 | state.exStatus << 6 |
+                        state.memStatus << 9 | state.wbStatus << 12;
+    PipeTraceRecord record;
+    record.info = static_cast<uint32_t>(delta) | (statuses << PIPE_TRACE_DELTA_BITS);
+    record.ifPC = static_cast<uint32_t>(state.ifPC);
+    record.idInstr = static_cast<uint32_t>(state.idInstr);
+    record.exInstr = static_cast<uint32_t>(state.exInstr);
+    record.memInstr = static_cast<uint32_t>(state.memInstr);
+    record.wbInstr = static_cast<uint32_t>(state.wbInstr);
+    pipe_out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    lastCycle = state.cycle;
+    return pipe_out ? SUCCESS : ERROR;
+}
+
+Status PipeStateWriter::close() {
+    if (!pipe_out.is_open()) return SUCCESS;
+    pipe_out.close();
+    return pipe_out ? SUCCESS : ERROR;
+}
+
+Status PipeTraceReader::open(const std::string &file_name) {
+    trace_in.open(file_name, std::ios::in | std::ios::binary);
+    if (!trace_in) {
+        std::cerr << LOG_ERROR << "Could not open pipe trace file " << file_name << std::endl;
+        return ERROR;
+    }
+
+    PipeTraceHeader header{};
+    trace_in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!trace_in || header.magic != PIPE_TRACE_MAGIC) {
+        std::cerr << LOG_ERROR << file_name << " is not a binary pipe trace" << std::endl;
+        return ERROR;
+    }
+    if (header.version != PIPE_TRACE_VERSION || header.recordSize != sizeof(PipeTraceRecord)) {
+        std::cerr << LOG_ERROR << "Unsupported pipe trace version " << header.version
+                  << std::endl;
+        return ERROR;
+    }
+    cycle = 0;
+    return SUCCESS;
+}
+
+bool PipeTraceReader::next(PipeState &state) {
+    PipeTraceRecord record;
+    while (trace_in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+        uint32_t statuses = record.info >> PIPE_TRACE_DELTA_BITS;
+        cycle += record.info & PIPE_TRACE_MAX_DELTA;
+        if (statuses == PIPE_TRACE_SKIP) continue;
+
+        state.cycle = cycle;
+        state.ifStatus = static_cast<StageStatus>(statuses & 0x7);
+        state.idStatus = static_cast<StageStatus>((statuses >> 3) & 0x7);
+        state.exStatus = static_cast<StageStatus>((statuses >> 6) & 0x7);
+        state.memStatus = static_cast<StageStatus>((statuses >> 9) & 0x7);
+        state.wbStatus = static_cast<StageStatus>((statuses >> 12) & 0x7);
+        state.ifPC = record.ifPC;
+        state.idInstr = record.idInstr;
+        state.exInstr = record.exInstr;
+        state.memInstr = record.memInstr;
+        state.wbInstr = record.wbInstr;
+        return true;
+    }
+    return false;
 }
 
 Status dumpSimStats(SimulationStats &stats, const std::string &base_output_name) {
@@ -436,6 +543,8 @@ Status dumpSimStats(SimulationStats &stats, const std::string &base_output_name)
         simStats << std::left << std::setw(23) << "D-cache hits: "        << stats.dcHits << std::endl;
         simStats << std::left << std::setw(23) << "D-cache misses: "      << stats.dcMisses << std::endl;
         simStats << std::left << std::setw(23) << "Load-use stalls: "     << stats.loadUseStalls << std::endl;
+        simStats << std::left << std::setw(23) << "D-cache writebacks: "  << stats.dcWritebacks << std::endl;
+        simStats << std::left << std::setw(23) << "D-cache writethroughs: " << stats.dcWriteThroughs << std::endl;
         return SUCCESS;
     } else {
         std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #define NUM_REGS 32
 
@@ -22,6 +23,11 @@
 
 enum Status { SUCCESS = 0, ERROR = 1, HALT = 2 };
 
+// Reserved encodings next to the 0xfeedfeed halt: markers around the region of interest.
+// Both are compressed-quadrant words no RV64I instruction uses, and execute as no-ops.
+#define ROI_BEGIN_INSTRUCTION 0xfeedf00d
+#define ROI_END_INSTRUCTION 0xfeedd0ed
+
 // Printing code...
 enum OPCODES {
     // R-type opcodes
@@ -131,6 +137,8 @@ struct SimulationStats {
     uint64_t dcHits;
     uint64_t dcMisses;
     uint64_t loadUseStalls;
+    uint64_t dcWritebacks;
+    uint64_t dcWriteThroughs;
 };
 
 // extract specific bits [start, end] from a 32 bit instruction
@@ -143,9 +151,91 @@ uint32_t sext32(uint32_t imm, int signBit);
 uint64_t sext64(uint64_t imm, int signBit);
 
 // Implemented in UtilityFunctions.o
-Status dumpPipeState(PipeState& state, const std::string& base_output_name);
 Status dumpSimStats(SimulationStats& stats, const std::string& base_output_name);
 
+// print one pipe state line (without the trailing newline)
+void printPipeState(PipeState& state, std::ostream& pipe_out);
+
+enum PipeTraceFormat { TRACE_TEXT = 0, TRACE_BINARY };
+
+// Binary pipe trace (<base>_pipe_state.bin): a PipeTraceHeader followed by one
+// fixed-size PipeTraceRecord per traced cycle. Records store the raw encodings only;
+// the pipetrace tool renders them back into the text format of printPipeState().
+#define PIPE_TRACE_MAGIC 0x54505652  // "RVPT"
+#define PIPE_TRACE_VERSION 1
+#define PIPE_TRACE_DELTA_BITS 17
+#define PIPE_TRACE_MAX_DELTA ((1U << PIPE_TRACE_DELTA_BITS) - 1)
+// Status bits of a record that only advances the cycle counter
+#define PIPE_TRACE_SKIP 0x7FFFU
+
+struct PipeTraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+};
+
+struct PipeTraceRecord {
+    // bits [16:0]: cycles since the previous record
+    // bits [31:17]: 3-bit IF, ID, EX, MEM, WB status (IF in the low bits)
+    uint32_t info;
+    uint32_t ifPC;
+    uint32_t idInstr;
+    uint32_t exInstr;
+    uint32_t memInstr;
+    uint32_t wbInstr;
+};
+
+// Which cycles of a sim_cycle run end up in the pipe trace
+enum TraceMode {
+    TRACE_ALL = 0,  // every cycle (default)
+    TRACE_OFF,      // no pipe trace at all
+    TRACE_WINDOW,   // cycles in [windowStart, windowEnd)
+    TRACE_SAMPLED,  // every interval-th cycle
+    TRACE_EVENTS,   // cycles with a stall, squash or exception
+};
+
+struct TraceConfig {
+    TraceMode mode = TRACE_ALL;
+    PipeTraceFormat format = TRACE_TEXT;
+    uint64_t windowStart = 0;
+    uint64_t windowEnd = 0;
+    uint64_t interval = 1;
+};
+
+// Size of the user-space buffer behind PipeStateWriter (1 MB)
+#define PIPE_STATE_BUFFER_SIZE (1 << 20)
+
+// Writes printPipeState() lines to <base>_pipe_state.out, keeping it open for the
+// whole run and only hitting the file system when its buffer fills up.
+// In TRACE_BINARY mode it writes <base>_pipe_state.bin records instead.
+class PipeStateWriter {
+   private:
+    std::ofstream pipe_out;
+    std::vector<char> buffer;
+    PipeTraceFormat format = TRACE_TEXT;
+    uint64_t lastCycle = 0;
+
+   public:
+    PipeStateWriter() = default;
+    ~PipeStateWriter();
+
+    Status open(const std::string& base_output_name, PipeTraceFormat traceFormat = TRACE_TEXT);
+    Status write(PipeState& state);
+    Status close();
+};
+
+// Reads the records of a binary pipe trace back into PipeStates
+class PipeTraceReader {
+   private:
+    std::ifstream trace_in;
+    uint64_t cycle = 0;
+
+   public:
+    Status open(const std::string& file_name);
+    // @return false once the trace is exhausted
+    bool next(PipeState& state);
+};
+
 // handle output file names
 inline std::string getBaseFilename(const char* inputPath) {
     std::string path(inputPath);
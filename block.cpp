@@ -0,0 +1,472 @@
+#include "block.h"
+
+#include <algorithm>
+
+#include "native.h"
+
+// ===== Micro-op handlers =====
+// Each handler mirrors the corresponding execute handler in simulator.cpp and
+// Simulator::simMemAccess() so that results stay bit-exact.
+
+#define ALU_RR(name, expr)                                  \
+    static bool name(BlockState& s, const MicroOp& op) {    \
+        uint64_t a = s.regs[op.rs1];                        \
+        uint64_t b = s.regs[op.rs2];                        \
+        s.regs[op.rd] = (expr);                             \
+        return true;                                        \
+    }
+
+#define ALU_RI(name, expr)                                  \
+    static bool name(BlockState& s, const MicroOp& op) {    \
+        uint64_t a = s.regs[op.rs1];                        \
+        uint64_t imm = op.imm;                              \
+        s.regs[op.rd] = (expr);                             \
+        return true;                                        \
+    }
+
+#define BRANCH(name, cond)                                  \
+    static bool name(BlockState& s, const MicroOp& op) {    \
+        uint64_t a = s.regs[op.rs1];                        \
+        uint64_t b = s.regs[op.rs2];                        \
+        s.nextPC = (cond) ? op.imm : op.PC + 4;             \
+        return false;                                       \
+    }
+
+ALU_RR(opAdd, a + b)
+ALU_RR(opSub, a - b)
+ALU_RR(opSll, a << (b & 0x3F))
+ALU_RR(opSlt, (int64_t)a < (int64_t)b)
+ALU_RR(opSltu, a < b)
+ALU_RR(opXor, a ^ b)
+ALU_RR(opSrl, a >> (b & 0x3F))
+ALU_RR(opSra, (int64_t)a >> (b & 0x3F))
+ALU_RR(opOr, a | b)
+ALU_RR(opAnd, a & b)
+ALU_RR(opAddw, sext64((uint32_t)a + (uint32_t)b, 31))
+ALU_RR(opSubw, sext64((uint32_t)a - (uint32_t)b, 31))
+ALU_RR(opSllw, sext64((uint32_t)a << (uint32_t)(b & 0x1F), 31))
+ALU_RR(opSrlw, sext64((uint32_t)a >> (uint32_t)(b & 0x1F), 31))
+ALU_RR(opSraw, sext64((int32_t)a >> (uint32_t)(b & 0x1F), 31))
+
+ALU_RI(opAddi, a + imm)
+ALU_RI(opSlli, a << (imm & 0x3F))
+ALU_RI(opSlti, (int64_t)a < (int64_t)imm)
+ALU_RI(opSltiu, a < imm)
+ALU_RI(opXori, a ^ imm)
+ALU_RI(opSrli, a >> (imm & 0x3F))
+ALU_RI(opSrai, (int64_t)a >> (imm & 0x3F))
+ALU_RI(opOri, a | imm)
+ALU_RI(opAndi, a & imm)
+ALU_RI(opAddiw, sext64((uint32_t)a + (uint32_t)imm, 31))
+ALU_RI(opSlliw, sext64((uint32_t)a << (uint32_t)(imm & 0x1F), 31))
+ALU_RI(opSrliw, sext64((uint32_t)a >> (uint32_t)(imm & 0x1F), 31))
+ALU_RI(opSraiw, sext64((int32_t)a >> (uint32_t)(imm & 0x1F), 31))
+
+BRANCH(opBeq, a == b)
+BRANCH(opBne, a != b)
+BRANCH(opBlt, (int64_t)a < (int64_t)b)
+BRANCH(opBge, (int64_t)a >= (int64_t)b)
+BRANCH(opBltu, a < b)
+BRANCH(opBgeu, a >= b)
+
+// LUI and AUIPC: the value is fully known at translation time
+static bool opLoadImm(BlockState& s, const MicroOp& op) {
+    s.regs[op.rd] = op.imm;
+    return true;
+}
+
+static bool opNop(BlockState&, const MicroOp&) {
+    return true;
+}
+
+static bool opJal(BlockState& s, const MicroOp& op) {
+    s.regs[op.rd] = op.PC + 4;
+    s.regs[0] = 0;
+    s.nextPC = op.imm;
+    return false;
+}
+
+static bool opJalr(BlockState& s, const MicroOp& op) {
+    uint64_t target = (s.regs[op.rs1] + op.imm) & ~1ULL;
+    s.regs[op.rd] = op.PC + 4;
+    s.regs[0] = 0;
+    s.nextPC = target;
+    return false;
+}
+
+// A failed load still writes rd, with the 0 simMemAccess() leaves in memResult
+template <bool isSigned>
+static bool opLoad(BlockState& s, const MicroOp& op) {
+    uint64_t value;
+    MemEntrySize size = static_cast<MemEntrySize>(op.size);
+    if (s.memory->getMemValue(s.regs[op.rs1] + op.imm, value, size) != 0) {
+        value = 0;
+    } else if (isSigned) {
+        value = sext64(value, size * 8 - 1);
+    }
+    s.regs[op.rd] = value;
+    s.regs[0] = 0;
+    return true;
+}
+
+static bool opStore(BlockState& s, const MicroOp& op) {
+    uint64_t address = s.regs[op.rs1] + op.imm;
+    if (s.memory->setMemValue(address, s.regs[op.rs2], static_cast<MemEntrySize>(op.size)) != 0) {
+        return true;
+    }
+    s.engine->storeDone(address, op.size);
+    if (s.engine->isCode(address, op.size)) {
+        // The rest of this block (or any other one) may be stale: leave and retranslate
+        s.codeModified = true;
+        s.nextPC = op.PC + 4;
+        return false;
+    }
+    return true;
+}
+
+// simInstruction() leaves nextPC at 0 for halt and illegal instructions
+static bool opHalt(BlockState& s, const MicroOp&) {
+    s.status = HALT;
+    s.nextPC = 0;
+    return false;
+}
+
+static bool opIllegal(BlockState& s, const MicroOp&) {
+    s.status = ERROR;
+    s.nextPC = 0;
+    return false;
+}
+
+// Falls through to the next block when a block ends without a control transfer
+static bool opExit(BlockState& s, const MicroOp& op) {
+    s.nextPC = op.imm;
+    return false;
+}
+
+// ===== Translation =====
+
+// Handlers indexed by MicroOpKind
+static const OpHandler opHandlers[UOP_COUNT] = {
+    opAdd,  // UOP_ADD
+    opSub,  // UOP_SUB
+    opSll,  // UOP_SLL
+    opSlt,  // UOP_SLT
+    opSltu,  // UOP_SLTU
+    opXor,  // UOP_XOR
+    opSrl,  // UOP_SRL
+    opSra,  // UOP_SRA
+    opOr,  // UOP_OR
+    opAnd,  // UOP_AND
+    opAddw,  // UOP_ADDW
+    opSubw,  // UOP_SUBW
+    opSllw,  // UOP_SLLW
+    opSrlw,  // UOP_SRLW
+    opSraw,  // UOP_SRAW
+    opAddi,  // UOP_ADDI
+    opSlli,  // UOP_SLLI
+    opSlti,  // UOP_SLTI
+    opSltiu,  // UOP_SLTIU
+    opXori,  // UOP_XORI
+    opSrli,  // UOP_SRLI
+    opSrai,  // UOP_SRAI
+    opOri,  // UOP_ORI
+    opAndi,  // UOP_ANDI
+    opAddiw,  // UOP_ADDIW
+    opSlliw,  // UOP_SLLIW
+    opSrliw,  // UOP_SRLIW
+    opSraiw,  // UOP_SRAIW
+    opBeq,  // UOP_BEQ
+    opBne,  // UOP_BNE
+    opBlt,  // UOP_BLT
+    opBge,  // UOP_BGE
+    opBltu,  // UOP_BLTU
+    opBgeu,  // UOP_BGEU
+    opLoad<false>,  // UOP_LOAD
+    opLoad<true>,  // UOP_LOAD_SIGNED
+    opStore,  // UOP_STORE
+    opLoadImm,  // UOP_LOAD_IMM
+    opNop,  // UOP_NOP
+    opJal,  // UOP_JAL
+    opJalr,  // UOP_JALR
+    opHalt,  // UOP_HALT
+    opIllegal,  // UOP_ILLEGAL
+    opExit,  // UOP_EXIT
+};
+
+static MicroOpKind selectKind(const Simulator::Instruction& inst) {
+    uint64_t upperImm12 = inst.funct7 >> 1;
+    switch (inst.opcode) {
+        case OP_INT:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:
+                    return inst.funct7 == FUNCT7_SUB ? UOP_SUB : UOP_ADD;
+                case FUNCT3_SLL:
+                    return UOP_SLL;
+                case FUNCT3_SLT:
+                    return UOP_SLT;
+                case FUNCT3_SLTU:
+                    return UOP_SLTU;
+                case FUNCT3_XOR:
+                    return UOP_XOR;
+                case FUNCT3_SR:
+                    return upperImm12 == UPPERIMM_ARITH ? UOP_SRA : UOP_SRL;
+                case FUNCT3_OR:
+                    return UOP_OR;
+                default:
+                    return UOP_AND;
+            }
+        case OP_INTW:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:
+                    return inst.funct7 == FUNCT7_SUB ? UOP_SUBW : UOP_ADDW;
+                case FUNCT3_SLL:
+                    return UOP_SLLW;
+                default:
+                    return upperImm12 == UPPERIMM_ARITH ? UOP_SRAW : UOP_SRLW;
+            }
+        case OP_INTIMM:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:
+                    return UOP_ADDI;
+                case FUNCT3_SLL:
+                    return UOP_SLLI;
+                case FUNCT3_SLT:
+                    return UOP_SLTI;
+                case FUNCT3_SLTU:
+                    return UOP_SLTIU;
+                case FUNCT3_XOR:
+                    return UOP_XORI;
+                case FUNCT3_SR:
+                    return upperImm12 == UPPERIMM_ARITH ? UOP_SRAI : UOP_SRLI;
+                case FUNCT3_OR:
+                    return UOP_ORI;
+                default:
+                    return UOP_ANDI;
+            }
+        case OP_INTIMMW:
+            switch (inst.funct3) {
+                case FUNCT3_ADD:
+                    return UOP_ADDIW;
+                case FUNCT3_SLL:
+                    return UOP_SLLIW;
+                default:
+                    return upperImm12 == UPPERIMM_ARITH ? UOP_SRAIW : UOP_SRLIW;
+            }
+        case OP_LOAD:
+            return (inst.funct3 == FUNCT3_B || inst.funct3 == FUNCT3_H ||
+                    inst.funct3 == FUNCT3_W) ? UOP_LOAD_SIGNED : UOP_LOAD;
+        case OP_STORE:
+            return UOP_STORE;
+        case OP_BRANCH:
+            switch (inst.funct3) {
+                case FUNCT3_BEQ:
+                    return UOP_BEQ;
+                case FUNCT3_BNE:
+                    return UOP_BNE;
+                case FUNCT3_BLT:
+                    return UOP_BLT;
+                case FUNCT3_BGE:
+                    return UOP_BGE;
+                case FUNCT3_BLTU:
+                    return UOP_BLTU;
+                default:
+                    return UOP_BGEU;
+            }
+        case OP_JAL:
+            return UOP_JAL;
+        case OP_JALR:
+            return UOP_JALR;
+        default:
+            return UOP_LOAD_IMM;  // OP_LUI, OP_AUIPC
+    }
+}
+
+static uint8_t accessSize(uint64_t funct3) {
+    return (funct3 == FUNCT3_B || funct3 == FUNCT3_BU) ? BYTE_SIZE :
+           (funct3 == FUNCT3_H || funct3 == FUNCT3_HU) ? HALF_SIZE :
+           (funct3 == FUNCT3_W || funct3 == FUNCT3_WU) ? WORD_SIZE : DOUBLE_SIZE;
+}
+
+Block* BlockEngine::translate(uint64_t PC) {
+    Block* block = new Block();
+    block->startPC = PC;
+
+    uint64_t pc = PC;
+    bool terminated = false;
+    while (!terminated && block->ops.size() < BLOCK_MAX_INSTRUCTIONS) {
+        auto inst = simulator->simFetch(pc, simulator->memory);
+        simulator->simDecode(inst);
+
+        MicroOp op{};
+        op.PC = pc;
+        op.rd = static_cast<uint8_t>(inst.rd);
+        op.rs1 = static_cast<uint8_t>(inst.rs1);
+        op.rs2 = static_cast<uint8_t>(inst.rs2);
+        op.imm = inst.imm;
+        op.countsAsInstruction = true;
+
+        if (inst.isHalt) {
+            op.kind = UOP_HALT;
+            terminated = true;
+        } else if (!inst.isLegal) {
+            op.kind = UOP_ILLEGAL;
+            terminated = true;
+        } else if (inst.isNop || inst.roiMarker != ROI_NONE) {
+            op.kind = UOP_NOP;
+        } else {
+            op.kind = selectKind(inst);
+            op.size = accessSize(inst.funct3);
+            switch (inst.opcode) {
+                case OP_BRANCH:
+                case OP_JAL:
+                    op.imm = pc + inst.imm;  // pre-resolved target
+                    terminated = true;
+                    break;
+                case OP_JALR:
+                    terminated = true;
+                    break;
+                case OP_AUIPC:
+                    op.imm = pc + inst.imm;
+                    break;
+                default:
+                    break;
+            }
+            // Writes to x0 without side effects are dropped
+            if (op.rd == 0 && inst.doesArithLogic && inst.opcode != OP_JAL &&
+                inst.opcode != OP_JALR) {
+                op.kind = UOP_NOP;
+            }
+        }
+        op.handler = opHandlers[op.kind];
+        block->ops.push_back(op);
+        pc += 4;
+    }
+    block->instructions = block->ops.size();
+
+    if (!terminated) {
+        MicroOp exit{};
+        exit.kind = UOP_EXIT;
+        exit.handler = opHandlers[UOP_EXIT];
+        exit.PC = pc;
+        exit.imm = pc;
+        exit.countsAsInstruction = false;
+        block->ops.push_back(exit);
+    }
+    block->endPC = pc;
+
+    // Remember which words hold translated code so stores to them can be caught
+    if (codeWords.size() <= ((pc - 1) >> 2)) codeWords.resize(((pc - 1) >> 2) + 1, 0);
+    for (uint64_t word = PC >> 2; word <= ((pc - 1) >> 2); word++) codeWords[word] = 1;
+    codeLo = std::min(codeLo, PC);
+    codeHi = std::max(codeHi, pc);
+
+    blocks[PC] = block;
+    return block;
+}
+
+Block* BlockEngine::lookup(uint64_t PC) {
+    auto it = blocks.find(PC);
+    if (it != blocks.end()) return it->second;
+    return translate(PC);
+}
+
+void BlockEngine::flush() {
+    for (auto& entry : blocks) delete entry.second;
+    blocks.clear();
+    if (native) native->flush();
+    std::fill(codeWords.begin(), codeWords.end(), 0);
+    codeLo = UINT64_MAX;
+    codeHi = 0;
+}
+
+BlockEngine::~BlockEngine() {
+    flush();
+    delete native;
+}
+
+bool BlockEngine::enableNative() {
+    if (!native) native = new NativeBackend();
+    if (native->available()) return true;
+    delete native;
+    native = nullptr;
+    return false;
+}
+
+bool BlockEngine::isCode(uint64_t address, uint64_t size) {
+    if (address >= codeHi || address + size <= codeLo) return false;
+    for (uint64_t word = address >> 2; word <= ((address + size - 1) >> 2); word++) {
+        if (word < codeWords.size() && codeWords[word]) return true;
+    }
+    return false;
+}
+
+void BlockEngine::storeDone(uint64_t address, uint64_t size) {
+    simulator->invalidateDecoded(address, size);
+}
+
+Status BlockEngine::run(uint64_t& PC, uint64_t maxInstructions, uint64_t& executed) {
+    BlockState state{simulator->regData.registers, simulator->memory, this, 0, SUCCESS, false};
+    // simCommit() may have left a value in x0; reads of x0 must see 0
+    state.regs[0] = 0;
+    executed = 0;
+
+    Block* block = lookup(PC);
+    while (true) {
+        uint64_t remaining = maxInstructions ? maxInstructions - executed : UINT64_MAX;
+        if (remaining == 0) return SUCCESS;
+
+        const MicroOp* first = block->ops.data();
+        const MicroOp* op = first;
+        uint64_t count;
+        if (native && !block->native && block->executions++ == NATIVE_HOT_THRESHOLD) {
+            block->native = native->compile(*block);
+        }
+        if (block->native && block->instructions <= remaining) {
+            state.nextPC = block->native(state.regs, &state);
+            // a store into translated code leaves right after itself
+            count = state.codeModified ? (state.nextPC - block->startPC) / 4 : block->instructions;
+        } else if (block->instructions <= remaining) {
+            while (op->handler(state, *op)) op++;
+            count = (op - first) + (op->countsAsInstruction ? 1 : 0);
+        } else {
+            // Only part of the block fits in the instruction budget
+            bool left = false;
+            for (count = 0; count < remaining && !left; count++, op++) {
+                left = !op->handler(state, *op);
+            }
+            if (!left) {
+                simulator->din += count;
+                executed += count;
+                PC = op->PC;
+                return SUCCESS;
+            }
+        }
+        simulator->din += count;
+        executed += count;
+
+        uint64_t nextPC = state.nextPC;
+        PC = nextPC;
+        if (state.status != SUCCESS) return state.status;
+        if (state.codeModified) {
+            state.codeModified = false;
+            flush();
+            if (stepBlocks) return SUCCESS;
+            block = lookup(nextPC);
+            continue;
+        }
+        if (stepBlocks) return SUCCESS;
+
+        // Follow (or create) the chain link to the successor block
+        if (block->nextPC[0] == nextPC) {
+            block = block->next[0];
+        } else if (block->nextPC[1] == nextPC) {
+            block = block->next[1];
+        } else {
+            Block* next = lookup(nextPC);
+            int slot = block->next[0] == nullptr ? 0 : 1;
+            block->nextPC[slot] = nextPC;
+            block->next[slot] = next;
+            block = next;
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <inttypes.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryStore.h"
+#include "Utilities.h"
+#include "simulator.h"
+
+// Longest straight-line run translated into one block
+#define BLOCK_MAX_INSTRUCTIONS 64
+
+class BlockEngine;
+class NativeBackend;
+struct BlockState;
+struct MicroOp;
+
+// Host code for one Block: runs the whole block on regs and returns the next guest PC
+typedef uint64_t (*NativeBlock)(uint64_t* regs, BlockState* state);
+
+// Operation of a micro-op; selects its handler and, for NativeBackend, the host code
+enum MicroOpKind : uint8_t {
+    UOP_ADD, UOP_SUB, UOP_SLL, UOP_SLT, UOP_SLTU, UOP_XOR, UOP_SRL, UOP_SRA, UOP_OR, UOP_AND,
+    UOP_ADDW, UOP_SUBW, UOP_SLLW, UOP_SRLW, UOP_SRAW,
+    UOP_ADDI, UOP_SLLI, UOP_SLTI, UOP_SLTIU, UOP_XORI, UOP_SRLI, UOP_SRAI, UOP_ORI, UOP_ANDI,
+    UOP_ADDIW, UOP_SLLIW, UOP_SRLIW, UOP_SRAIW,
+    UOP_BEQ, UOP_BNE, UOP_BLT, UOP_BGE, UOP_BLTU, UOP_BGEU,
+    UOP_LOAD, UOP_LOAD_SIGNED, UOP_STORE,
+    UOP_LOAD_IMM, UOP_NOP, UOP_JAL, UOP_JALR,
+    UOP_HALT, UOP_ILLEGAL, UOP_EXIT,
+    UOP_COUNT
+};
+
+// Architectural state the micro-op handlers work on while a block runs
+struct BlockState {
+    uint64_t* regs;
+    MemoryStore* memory;
+    BlockEngine* engine;
+    uint64_t nextPC;
+    Status status;       // HALT or ERROR once the block hit 0xfeedfeed or an illegal instruction
+    bool codeModified;   // a store overwrote translated code
+};
+
+// A handler executes one micro-op; it returns false when the block has to be left
+// after it (control transfer, halt, illegal instruction, store into translated code)
+typedef bool (*OpHandler)(BlockState& state, const MicroOp& op);
+
+struct MicroOp {
+    OpHandler handler;
+    uint64_t PC;
+    uint64_t imm;        // pre-extracted immediate, or the target for direct jumps/branches
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t size;        // memory access size in bytes
+    MicroOpKind kind;
+    bool countsAsInstruction;
+};
+
+struct Block {
+    uint64_t startPC;
+    uint64_t endPC;      // PC right after the last translated instruction
+    std::vector<MicroOp> ops;
+    uint64_t instructions;
+    // Chained successors, filled in the first time the block exits to them
+    uint64_t nextPC[2] = {UINT64_MAX, UINT64_MAX};
+    Block* next[2] = {nullptr, nullptr};
+    // Compiled by NativeBackend once the block has run NATIVE_HOT_THRESHOLD times
+    NativeBlock native = nullptr;
+    uint32_t executions = 0;
+};
+
+// Functional execution engine that translates basic blocks (ending at a branch, JAL,
+// JALR, halt or illegal instruction) into arrays of pre-decoded micro-ops with direct
+// handler pointers, caches them by entry PC and chains them together.
+// Results are bit-exact with Simulator::simInstruction().
+class BlockEngine {
+   private:
+    Simulator* simulator;
+    std::unordered_map<uint64_t, Block*> blocks;
+    // One flag per 4-byte word of memory that is part of a translated block
+    std::vector<uint8_t> codeWords;
+    uint64_t codeLo = UINT64_MAX;
+    uint64_t codeHi = 0;
+    NativeBackend* native = nullptr;
+    // return after every block instead of chaining (lock-step checking)
+    bool stepBlocks = false;
+
+    Block* translate(uint64_t PC);
+    Block* lookup(uint64_t PC);
+    void flush();
+
+   public:
+    explicit BlockEngine(Simulator* sim) : simulator(sim) {}
+    ~BlockEngine();
+
+    /** Execute up to maxInstructions instructions (0 = unlimited) starting at PC
+     * @return HALT or ERROR when 0xfeedfeed or an illegal instruction was executed,
+     *      SUCCESS once the instruction budget is used up
+     * @param
+     *      PC: in/out program counter
+     *      executed: number of instructions executed by this call
+     */
+    Status run(uint64_t& PC, uint64_t maxInstructions, uint64_t& executed);
+
+    // Compile hot blocks to host code; false if this host has no native backend
+    bool enableNative();
+    void setStepBlocks(bool step) { stepBlocks = step; }
+
+    // Called by store handlers: true if [address, address + size) holds translated code
+    bool isCode(uint64_t address, uint64_t size);
+    // Keeps the simulator's own decode cache coherent with stores done by the engine
+    void storeDone(uint64_t address, uint64_t size);
+};
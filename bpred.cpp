@@ -0,0 +1,199 @@
+#include "bpred.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+static const char* const PREDICTOR_NAMES[PREDICT_COUNT] = {"none", "btfn", "bimodal", "gshare",
+                                                           "tournament"};
+
+const char* predictorName(PredictorKind kind) {
+    return kind < PREDICT_COUNT ? PREDICTOR_NAMES[kind] : "unknown";
+}
+
+bool parsePredictor(const std::string& name, PredictorKind& kind) {
+    for (int i = 0; i < PREDICT_COUNT; i++) {
+        if (name == PREDICTOR_NAMES[i]) {
+            kind = static_cast<PredictorKind>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string checkPredictorConfig(const PredictorConfig& config) {
+    if (config.btbEntries == 0 || (config.btbEntries & (config.btbEntries - 1)) != 0) {
+        return "BTB entries must be a power of 2";
+    }
+    if (config.tableBits == 0 || config.tableBits > 24) {
+        return "predictor table bits must be between 1 and 24";
+    }
+    return "";
+}
+
+void BranchPredictor::ReturnStack::push(uint64_t address) {
+    if (entries.empty()) return;
+    top = (top + 1) % entries.size();
+    entries[top] = address;
+    if (depth < entries.size()) depth++;
+}
+
+bool BranchPredictor::ReturnStack::pop(uint64_t& address) {
+    if (depth == 0) return false;
+    address = entries[top];
+    top = (top + entries.size() - 1) % entries.size();
+    depth--;
+    return true;
+}
+
+// Saturating 2-bit counter: 0 and 1 predict not taken, 2 and 3 taken
+static void train(uint8_t& counter, bool taken) {
+    if (taken && counter < 3) counter++;
+    if (!taken && counter > 0) counter--;
+}
+
+BranchPredictor::BranchPredictor(const PredictorConfig& config)
+    : config(config),
+      btb(config.btbEntries),
+      bimodal(1ULL << config.tableBits, 1),
+      gshare(1ULL << config.tableBits, 1),
+      chooser(1ULL << config.tableBits, 1),
+      tableMask((1ULL << config.tableBits) - 1) {
+    resolved.ras.entries.resize(config.rasEntries);
+    speculative = resolved;
+}
+
+// x1 (ra) and x5 (t0) are the link registers of the RISC-V calling convention
+static bool isLink(uint8_t reg) {
+    return reg == 1 || reg == 5;
+}
+
+// The RAS hints of the RISC-V spec; a JALR from one link register to the other pops
+// and then pushes, and one with rd == rs1 only pushes
+BranchPredictor::ControlKind BranchPredictor::classify(const Simulator::Instruction& inst) {
+    if (inst.opcode == OP_BRANCH) return BRANCH;
+    bool returns = inst.opcode == OP_JALR && isLink(inst.rs1);
+    if (isLink(inst.rd)) return returns && inst.rd != inst.rs1 ? COROUTINE : CALL;
+    if (returns) return RETURN;
+    return inst.opcode == OP_JALR ? INDIRECT : JUMP;
+}
+
+bool BranchPredictor::predictTaken(uint64_t pc, uint64_t target, uint64_t history) const {
+    switch (config.kind) {
+        case PREDICT_BTFN: return target <= pc;
+        case PREDICT_BIMODAL: return bimodal[(pc >> 2) & tableMask] >= 2;
+        case PREDICT_GSHARE: return gshare[gshareIndex(pc, history)] >= 2;
+        case PREDICT_TOURNAMENT:
+            return chooser[(pc >> 2) & tableMask] >= 2 ? gshare[gshareIndex(pc, history)] >= 2
+                                                       : bimodal[(pc >> 2) & tableMask] >= 2;
+        default: return false;
+    }
+}
+
+void BranchPredictor::advance(State& state, ControlKind kind, bool taken, uint64_t returnAddress,
+                              uint64_t historyMask) {
+    uint64_t popped;
+    switch (kind) {
+        case BRANCH: state.history = ((state.history << 1) | taken) & historyMask; break;
+        case CALL: state.ras.push(returnAddress); break;
+        case RETURN: state.ras.pop(popped); break;
+        case COROUTINE:
+            state.ras.pop(popped);
+            state.ras.push(returnAddress);
+            break;
+        default: break;
+    }
+}
+
+uint64_t BranchPredictor::predict(uint64_t pc) {
+    const BtbEntry& entry = btbEntry(pc);
+    if (!entry.valid || entry.pc != pc) return pc + 4;
+    inFlight.push_back(InFlight{pc, speculative.history});
+
+    switch (entry.kind) {
+        case BRANCH: {
+            bool taken = predictTaken(pc, entry.target, speculative.history);
+            advance(speculative, BRANCH, taken, 0, tableMask);
+            return taken ? entry.target : pc + 4;
+        }
+        case RETURN: {
+            uint64_t target;
+            // an empty stack falls back on the last return address seen here
+            return speculative.ras.pop(target) ? target : entry.target;
+        }
+        case CALL:
+            speculative.ras.push(pc + 4);
+            return entry.target;
+        case COROUTINE: {
+            uint64_t target;
+            bool popped = speculative.ras.pop(target);
+            speculative.ras.push(pc + 4);
+            return popped ? target : entry.target;
+        }
+        default:
+            return entry.target;
+    }
+}
+
+void BranchPredictor::forget(uint64_t pc) {
+    BtbEntry& entry = btbEntry(pc);
+    if (entry.valid && entry.pc == pc) entry.valid = false;
+    auto guess = std::find_if(inFlight.begin(), inFlight.end(),
+                              [&](const InFlight& f) { return f.pc == pc; });
+    if (guess != inFlight.end()) inFlight.erase(guess);
+}
+
+bool BranchPredictor::resolve(const Simulator::Instruction& inst) {
+    ControlKind kind = classify(inst);
+    uint64_t pc = inst.PC;
+    bool taken = inst.nextPC != pc + 4;
+    bool wrong = inst.predictedPC != inst.nextPC;
+    bool seen = !inFlight.empty() && inFlight.front().pc == pc;
+    uint64_t history = seen ? inFlight.front().history : resolved.history;
+    if (seen) inFlight.pop_front();
+
+    if (kind == BRANCH) {
+        branches++;
+        branchMispredictions += wrong;
+        // index with the history the branch was predicted with
+        uint8_t& local = bimodal[(pc >> 2) & tableMask];
+        uint8_t& global = gshare[gshareIndex(pc, history)];
+        bool localTaken = local >= 2;
+        bool globalTaken = global >= 2;
+        if (localTaken != globalTaken) train(chooser[(pc >> 2) & tableMask], globalTaken == taken);
+        train(local, taken);
+        train(global, taken);
+    } else {
+        jumps++;
+        jumpMispredictions += wrong;
+    }
+
+    // taken control instructions allocate; a not-taken branch keeps the entry it has
+    if (taken) btbEntry(pc) = BtbEntry{pc, inst.nextPC, kind, true};
+
+    // fetch already applied a BTB hit speculatively; a miss only matters once it redirects
+    if (seen || wrong) advance(resolved, kind, taken, pc + 4, tableMask);
+    return wrong;
+}
+
+Status BranchPredictor::dumpStats(const std::string& base_output_name,
+                                  uint64_t instructions) const {
+    std::ofstream simStats(base_output_name + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    uint64_t resolvedCount = branches + jumps;
+    uint64_t mispredictions = branchMispredictions + jumpMispredictions;
+    double accuracy =
+        resolvedCount ? 1.0 - static_cast<double>(mispredictions) / resolvedCount : 0.0;
+    double mpki = instructions ? 1000.0 * mispredictions / instructions : 0.0;
+    simStats << std::left << std::setw(23) << "Branches: "            << branches << std::endl;
+    simStats << std::left << std::setw(23) << "Branch mispredicts: "  << branchMispredictions << std::endl;
+    simStats << std::left << std::setw(23) << "Jumps: "               << jumps << std::endl;
+    simStats << std::left << std::setw(23) << "Jump mispredicts: "    << jumpMispredictions << std::endl;
+    simStats << std::left << std::setw(23) << "Prediction accuracy: " << std::fixed
+             << std::setprecision(3) << accuracy << std::endl;
+    simStats << std::left << std::setw(23) << "MPKI: "                << mpki << std::endl;
+    return SUCCESS;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <inttypes.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Utilities.h"
+#include "simulator.h"
+
+// Direction predictor of the fetch stage
+enum PredictorKind : uint8_t {
+    PREDICT_NONE,        // fetch falls through and ID redirects every taken branch and jump
+    PREDICT_BTFN,        // static: backward taken, forward not taken
+    PREDICT_BIMODAL,     // 2-bit counters indexed by PC
+    PREDICT_GSHARE,      // 2-bit counters indexed by PC xor global history
+    PREDICT_TOURNAMENT,  // bimodal and gshare, with a per-PC chooser between them
+    PREDICT_COUNT
+};
+
+// "none", "btfn", "bimodal", "gshare", "tournament"
+const char* predictorName(PredictorKind kind);
+// @return false if name is not one of the names above
+bool parsePredictor(const std::string& name, PredictorKind& kind);
+
+struct PredictorConfig {
+    PredictorKind kind = PREDICT_NONE;
+    uint64_t btbEntries = 512;  // direct mapped, a power of 2
+    uint64_t rasEntries = 8;
+    uint64_t tableBits = 12;    // log2 of the counter tables, and the gshare history length
+};
+
+// @return an error message, or "" if config is usable
+std::string checkPredictorConfig(const PredictorConfig& config);
+
+/** Next-PC prediction for the fetch stage. The BTB tells fetch which PCs hold control
+ * instructions and where they go; conditional branches in it take the direction
+ * predictor's guess, calls push their return address on the RAS and returns pop it.
+ * Fetch updates the history and RAS speculatively and remembers the history each BTB
+ * hit was predicted with. Control instructions resolve in order: resolve() trains the
+ * tables with that history and replays the instruction into the resolved history and
+ * RAS, and squash() drops every guess younger than the last resolved instruction.
+ * Branches missing in the BTB are invisible to fetch and stay out of the history.
+ */
+class BranchPredictor {
+   private:
+    // COROUTINE is a JALR between two different link registers: a return and a call
+    enum ControlKind : uint8_t { BRANCH, JUMP, CALL, RETURN, COROUTINE, INDIRECT };
+    struct BtbEntry {
+        uint64_t pc = 0;
+        uint64_t target = 0;
+        ControlKind kind = BRANCH;
+        bool valid = false;
+    };
+    // Circular: a push onto a full stack drops the oldest return address
+    struct ReturnStack {
+        std::vector<uint64_t> entries;
+        size_t top = 0;
+        size_t depth = 0;
+
+        void push(uint64_t address);
+        // @return false if the stack is empty
+        bool pop(uint64_t& address);
+    };
+    struct State {
+        uint64_t history = 0;  // conditional branch outcomes, the latest in bit 0
+        ReturnStack ras;
+    };
+    // A BTB hit fetch predicted and that has not resolved yet
+    struct InFlight {
+        uint64_t pc;
+        uint64_t history;
+    };
+
+    PredictorConfig config;
+    std::vector<BtbEntry> btb;
+    std::vector<uint8_t> bimodal;
+    std::vector<uint8_t> gshare;
+    std::vector<uint8_t> chooser;  // >= 2 picks gshare
+    uint64_t tableMask;
+    State resolved;
+    State speculative;
+    std::deque<InFlight> inFlight;  // oldest first
+
+    static ControlKind classify(const Simulator::Instruction& inst);
+    BtbEntry& btbEntry(uint64_t pc) { return btb[(pc >> 2) & (btb.size() - 1)]; }
+    uint64_t gshareIndex(uint64_t pc, uint64_t history) const {
+        return ((pc >> 2) ^ history) & tableMask;
+    }
+    bool predictTaken(uint64_t pc, uint64_t target, uint64_t history) const;
+    void forget(uint64_t pc);
+    // Apply a control instruction's effect on the history and RAS of state
+    static void advance(State& state, ControlKind kind, bool taken, uint64_t returnAddress,
+                        uint64_t historyMask);
+
+   public:
+    uint64_t branches = 0;  // conditional branches resolved
+    uint64_t branchMispredictions = 0;
+    uint64_t jumps = 0;     // JAL and JALR resolved
+    uint64_t jumpMispredictions = 0;
+
+    explicit BranchPredictor(const PredictorConfig& config);
+
+    // @return the PC to fetch after the instruction at pc
+    uint64_t predict(uint64_t pc);
+
+    /** Train on a control instruction that just resolved; call it in program order
+     * @return whether the fetch after it (inst.predictedPC) went the wrong way
+     */
+    bool resolve(const Simulator::Instruction& inst);
+
+    // The instruction fetched at pc decoded as no control instruction, e.g. after a store
+    // overwrote one: drop its BTB entry and the guess fetch made for it, which would
+    // otherwise never resolve
+    void notControl(uint64_t pc) {
+        if (!inFlight.empty()) forget(pc);
+    }
+
+    // Drop the guesses made for instructions squashed before they resolved
+    void squash() {
+        speculative = resolved;
+        inFlight.clear();
+    }
+
+    // Zero the counters above, keeping the tables trained
+    void resetStats() { branches = branchMispredictions = jumps = jumpMispredictions = 0; }
+
+    // Append the prediction counters, accuracy and MPKI to <base>_sim_stats.out
+    Status dumpStats(const std::string& base_output_name, uint64_t instructions) const;
+};
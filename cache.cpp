@@ -1,8 +1,257 @@
 #include "cache.h"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+static const char* const REPLACEMENT_NAMES[REPL_COUNT] = {
+    "lru", "tree-plru", "bit-plru", "fifo", "random", "srrip", "brrip"};
+
+const char* replacementName(ReplacementPolicy policy) {
+    return policy < REPL_COUNT ? REPLACEMENT_NAMES[policy] : "unknown";
+}
+
+bool parseReplacement(const std::string& name, ReplacementPolicy& policy) {
+    for (int i = 0; i < REPL_COUNT; i++) {
+        if (name == REPLACEMENT_NAMES[i]) {
+            policy = static_cast<ReplacementPolicy>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char* const INCLUSION_NAMES[] = {"nine", "inclusive", "exclusive"};
+
+const char* inclusionName(InclusionPolicy policy) {
+    return policy <= INCLUSION_EXCLUSIVE ? INCLUSION_NAMES[policy] : "unknown";
+}
+
+std::ostream& operator<<(std::ostream& os, const CacheConfig& config) {
+    os << "CacheConfig { " << config.cacheSize << ", " << config.blockSize << ", "
+       << config.ways << ", " << config.missLatency << ", "
+       << replacementName(config.replacement) << ", "
+       << (config.writeBack ? "write-back" : "write-through") << ", "
+       << (config.writeAllocate ? "write-allocate" : "no-write-allocate") << " }";
+    return os;
+}
+
+static uint64_t parseOptionNumber(const std::string& key, const std::string& value) {
+    size_t end;
+    uint64_t number = std::stoull(value, &end);
+    if (end != value.size()) throw std::invalid_argument("Bad " + key + " " + value);
+    return number;
+}
+
+// Apply one "<key> <value>" option line of a cache config file to config
+static void setCacheOption(CacheConfig& config, const std::string& key, const std::string& value) {
+    if (key == "replacement") {
+        if (!parseReplacement(value, config.replacement)) {
+            throw std::invalid_argument("Unknown replacement policy " + value);
+        }
+    } else if (key == "seed") {
+        config.seed = parseOptionNumber(key, value);
+    } else if (key == "writeback-latency") {
+        config.writebackLatency = parseOptionNumber(key, value);
+    } else if (key == "mshrs") {
+        config.mshrs = parseOptionNumber(key, value);
+    } else if (key == "prefetcher") {
+        if (!parsePrefetcher(value, config.prefetcher)) {
+            throw std::invalid_argument("Unknown prefetcher " + value);
+        }
+    } else if (key == "prefetch-degree") {
+        config.prefetchDegree = parseOptionNumber(key, value);
+    } else if (key == "prefetch-distance") {
+        config.prefetchDistance = parseOptionNumber(key, value);
+    } else if (key == "victim-entries") {
+        config.victimEntries = parseOptionNumber(key, value);
+    } else if (key == "victim-latency") {
+        config.victimLatency = parseOptionNumber(key, value);
+    } else if (key == "write") {
+        if (value != "write-back" && value != "write-through") {
+            throw std::invalid_argument("write must be write-back or write-through");
+        }
+        config.writeBack = value == "write-back";
+    } else if (key == "allocate") {
+        if (value != "write" && value != "no-write") {
+            throw std::invalid_argument("allocate must be write or no-write");
+        }
+        config.writeAllocate = value == "write";
+    } else {
+        throw std::invalid_argument("Unknown cache option " + key);
+    }
+}
+
+// Keys an L2 or L3 must be given, in the order of the CacheConfig fields they set
+static const char* const LEVEL_KEYS[] = {"size", "block", "ways", "latency"};
+
+// Apply one "<key> <value>" line of an L2 or L3 to config; given marks the LEVEL_KEYS set
+static void setLevelOption(CacheConfig& config, bool given[4], const std::string& key,
+                           const std::string& value) {
+    uint64_t* fields[4] = {&config.cacheSize, &config.blockSize, &config.ways,
+                           &config.hitLatency};
+    for (int i = 0; i < 4; i++) {
+        if (key == LEVEL_KEYS[i]) {
+            *fields[i] = parseOptionNumber(key, value);
+            given[i] = true;
+            return;
+        }
+    }
+    if (key == "inclusion") {
+        for (int i = INCLUSION_NINE; i <= INCLUSION_EXCLUSIVE; i++) {
+            if (value == INCLUSION_NAMES[i]) {
+                config.inclusion = static_cast<InclusionPolicy>(i);
+                return;
+            }
+        }
+        throw std::invalid_argument("inclusion must be nine, inclusive or exclusive");
+    }
+    setCacheOption(config, key, value);
+}
+
+void readCacheConfigs(const std::string& fileName, CacheConfig& icConfig, CacheConfig& dcConfig,
+                      HierarchyConfig* hierarchy) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        throw std::invalid_argument("Failed to open cache config file: " + fileName);
+    }
+
+    int line = 0;
+    auto parseNextLine = [&](const char* name) -> uint32_t {
+        line++;
+        uint32_t value;
+        if (!(file >> value)) {
+            std::stringstream errorMessage;
+            errorMessage << "Failed to parse property at line " << line << " for property "
+                         << name;
+            throw std::invalid_argument(errorMessage.str());
+        }
+        std::string discard;
+        std::getline(file, discard);  // discard rest of the line
+        return value;
+    };
+
+    icConfig = CacheConfig{parseNextLine("ICache cache size"), parseNextLine("ICache block size"),
+                           parseNextLine("ICache ways"), parseNextLine("ICache miss latency")};
+
+    dcConfig = CacheConfig{parseNextLine("DCache cache size"), parseNextLine("DCache block size"),
+                           parseNextLine("DCache ways"), parseNextLine("DCache miss latency")};
+
+    CacheConfig levels[2] = {};  // L2, L3
+    bool given[2][4] = {};
+    bool mentioned[2] = {};
+    bool memoryGiven = false;
+    uint64_t memoryLatency = 0;
+
+    std::string text;
+    while (std::getline(file, text)) {
+        line++;
+        std::stringstream option(text.substr(0, text.find('#')));
+        std::string name, value, extra;
+        if (!(option >> name)) continue;  // blank or comment-only line
+        size_t dot = name.find('.');
+        std::string cache = name.substr(0, dot);
+        bool lower = cache == "l2" || cache == "l3" || cache == "memory";
+        if (!(option >> value) || option >> extra || dot == std::string::npos ||
+            (cache != "icache" && cache != "dcache" && !lower)) {
+            std::stringstream errorMessage;
+            errorMessage << "Expected \"<icache|dcache|l2|l3|memory>.<key> <value>\" at line "
+                         << line;
+            throw std::invalid_argument(errorMessage.str());
+        }
+        std::string key = name.substr(dot + 1);
+        if (lower && !hierarchy) {
+            std::stringstream errorMessage;
+            errorMessage << "Only split L1 caches are modeled here, found " << name << " at line "
+                         << line;
+            throw std::invalid_argument(errorMessage.str());
+        }
+        if (cache == "memory") {
+            if (key != "latency") throw std::invalid_argument("Unknown memory option " + key);
+            memoryLatency = parseOptionNumber(name, value);
+            memoryGiven = true;
+        } else if (lower) {
+            int level = cache == "l2" ? 0 : 1;
+            mentioned[level] = true;
+            setLevelOption(levels[level], given[level], key, value);
+        } else {
+            setCacheOption(cache == "icache" ? icConfig : dcConfig, key, value);
+        }
+    }
+
+    if (!hierarchy) return;
+    hierarchy->levels.clear();
+    for (int level = 0; level < 2; level++) {
+        if (!mentioned[level]) continue;
+        std::string name = level == 0 ? "l2" : "l3";
+        for (bool set : given[level]) {
+            if (!set) throw std::invalid_argument(name + " needs size, block, ways and latency");
+        }
+        if (level == 1 && !mentioned[0]) throw std::invalid_argument("An l3 needs an l2");
+        hierarchy->levels.push_back(levels[level]);
+    }
+    if (!hierarchy->levels.empty() && !memoryGiven) {
+        throw std::invalid_argument("memory.latency is needed behind an l2");
+    }
+    hierarchy->memoryLatency = memoryLatency;
+}
+
+static bool isPowerOf2(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+std::string checkCacheConfig(const CacheConfig& config) {
+    if (!isPowerOf2(config.blockSize)) return "block size is not a power of 2";
+    if (config.ways == 0) return "ways must be at least 1";
+    if (config.cacheSize < config.blockSize * config.ways) return "cache is smaller than one set";
+    uint64_t numSets = config.cacheSize / (config.blockSize * config.ways);
+    if (!isPowerOf2(numSets) || numSets * config.blockSize * config.ways != config.cacheSize) {
+        return "number of sets is not a power of 2";
+    }
+    if (config.replacement == REPL_TREE_PLRU && !isPowerOf2(config.ways)) {
+        return "tree-plru needs a power of 2 ways";
+    }
+    if (config.replacement == REPL_LRU && config.ways > 65536) {
+        return "lru ranks cover at most 65536 ways";
+    }
+    if (config.prefetchDegree == 0) return "prefetch degree must be at least 1";
+    if (config.prefetchDistance == 0) return "prefetch distance must be at least 1";
+    if (config.victimEntries > 65536) return "a victim cache holds at most 65536 blocks";
+    return "";
+}
+
+std::string checkHierarchyConfig(const CacheConfig& icConfig, const CacheConfig& dcConfig,
+                                 const HierarchyConfig& hierarchy) {
+    std::string error = checkCacheConfig(icConfig);
+    if (!error.empty()) return "I-cache: " + error;
+    error = checkCacheConfig(dcConfig);
+    if (!error.empty()) return "D-cache: " + error;
+    // block sizes of the levels above the one being checked
+    uint64_t smallestAbove = std::min(icConfig.blockSize, dcConfig.blockSize);
+    uint64_t largestAbove = std::max(icConfig.blockSize, dcConfig.blockSize);
+    for (size_t i = 0; i < hierarchy.levels.size(); i++) {
+        const CacheConfig& level = hierarchy.levels[i];
+        std::string name = "L" + std::to_string(i + 2) + ": ";
+        error = checkCacheConfig(level);
+        if (!error.empty()) return name + error;
+        if (level.blockSize < largestAbove) return name + "block size is smaller than a level above";
+        if (level.inclusion == INCLUSION_EXCLUSIVE &&
+            (smallestAbove != level.blockSize || largestAbove != level.blockSize)) {
+            return name + "an exclusive level needs the block size of the levels above";
+        }
+        smallestAbove = std::min(smallestAbove, level.blockSize);
+        largestAbove = level.blockSize;
+    }
+    return "";
+}
+
 // Constructor definition
 Cache::Cache(CacheConfig configParam, CacheDataType cacheType)
     : hits(0),
@@ -16,41 +265,174 @@ Cache::Cache(CacheConfig configParam, CacheDataType cacheType)
     setIndexBits = static_cast<uint64_t>(std::log2(numSets));
     setIndexMask = (1ULL << setIndexBits) - 1;
 
-    sets.resize(numSets, std::vector<Line>(config.ways));
+    setStride = (config.ways + CACHE_MATCH_LANES - 1) / CACHE_MATCH_LANES * CACHE_MATCH_LANES;
+    tags.assign(numSets * setStride, 0);
+    valid.assign(numSets * setStride, 0);
+    dirty.assign(numSets * setStride, 0);
+
+    switch (config.replacement) {
+        case REPL_TREE_PLRU: initReplacement<TreePlruPolicy>(); break;
+        case REPL_BIT_PLRU: initReplacement<BitPlruPolicy>(); break;
+        case REPL_FIFO: initReplacement<FifoPolicy>(); break;
+        case REPL_RANDOM: initReplacement<RandomPolicy>(); break;
+        case REPL_SRRIP: initReplacement<SrripPolicy>(); break;
+        case REPL_BRRIP: initReplacement<BrripPolicy>(); break;
+        default: initReplacement<LruPolicy>(); break;
+    }
+}
+
+template <class Policy>
+void Cache::initReplacement() {
+    replacement.resize(numSets, config.ways, Policy::bitsPerSet(config.ways), Policy::wayRanks);
+    // xorshift never leaves a zero state
+    replacement.rng = config.seed ? config.seed : 1;
+    for (uint64_t set = 0; set < numSets; set++) Policy::reset(replacement, set);
+    accessFn = &Cache::accessWith<Policy>;
+    fillFn = &Cache::fillWith<Policy>;
+}
+
+int64_t Cache::findWay(uint64_t base, uint64_t tag) const {
+    const uint64_t* setTags = tags.data() + base;
+    const uint8_t* setValid = valid.data() + base;
+    // Invalid lines may hold any tag, so every match still checks the valid flag
+#if defined(__AVX2__)
+    const __m256i key = _mm256_set1_epi64x(static_cast<long long>(tag));
+    for (uint64_t way = 0; way < setStride; way += 4) {
+        __m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(setTags + way));
+        unsigned mask = static_cast<unsigned>(
+            _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lanes, key))));
+        for (; mask; mask &= mask - 1) {
+            uint64_t hit = way + __builtin_ctz(mask);
+            if (setValid[hit]) return static_cast<int64_t>(hit);
+        }
+    }
+#elif defined(__SSE2__)
+    // No 64-bit compare before SSE4.1: compare the 32-bit halves and require both
+    const __m128i key = _mm_set1_epi64x(static_cast<long long>(tag));
+    for (uint64_t way = 0; way < setStride; way += 2) {
+        __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(setTags + way));
+        __m128i halves = _mm_cmpeq_epi32(lanes, key);
+        __m128i equal = _mm_and_si128(halves, _mm_shuffle_epi32(halves, _MM_SHUFFLE(2, 3, 0, 1)));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(equal)));
+        for (; mask; mask &= mask - 1) {
+            uint64_t hit = way + __builtin_ctz(mask);
+            if (setValid[hit]) return static_cast<int64_t>(hit);
+        }
+    }
+#else
+    for (uint64_t way = 0; way < config.ways; way++) {
+        if (setValid[way] && setTags[way] == tag) return static_cast<int64_t>(way);
+    }
+#endif
+    return -1;
 }
 
 // Access method definition
-bool Cache::access(uint64_t address, CacheOperation /*readWrite*/) {
-    uint64_t setIndex = getSetIndex(address);
+template <class Policy>
+CacheAccess Cache::accessWith(uint64_t address, CacheOperation readWrite, bool allocate) {
+    uint64_t set = getSetIndex(address);
+    uint64_t base = set * setStride;
     uint64_t tag = getTag(address);
+    bool write = readWrite == CACHE_WRITE;
 
-    auto& set = sets.at(setIndex);
     // First, search for a hit.
-    for (auto& line : set) {
-        if (line.valid && line.tag == tag) {
-            hits++;
-            line.lastUsed = ++accessCounter;
-            return true;
+    int64_t way = findWay(base, tag);
+    if (way >= 0) {
+        hits++;
+        Policy::touch(replacement, set, static_cast<uint64_t>(way));
+        if (write) {
+            if (config.writeBack) dirty[base + way] = 1;
+            else writeThroughs++;
         }
+        return CacheAccess{true, true, false, false, 0};
     }
 
-    // Miss path: choose a victim using true LRU (oldest lastUsed or invalid).
     misses++;
-    auto* victim = &set.front();
-    for (auto& line : set) {
-        if (!line.valid) {
-            victim = &line;
-            break;
-        }
-        if (line.lastUsed < victim->lastUsed) {
-            victim = &line;
-        }
+    if (!allocate) {
+        // write around the cache
+        if (write) writeThroughs++;
+        return CacheAccess{false, false, false, false, 0};
     }
 
-    victim->valid = true;
-    victim->tag = tag;
-    victim->lastUsed = ++accessCounter;
-    return false;
+    if (write && !config.writeBack) writeThroughs++;
+    CacheAccess result = insert<Policy>(set, tag, write && config.writeBack);
+    result.hit = false;
+    return result;
+}
+
+template <class Policy>
+CacheAccess Cache::fillWith(uint64_t address, bool dirtyLine) {
+    uint64_t set = getSetIndex(address);
+    uint64_t base = set * setStride;
+    uint64_t tag = getTag(address);
+    int64_t way = findWay(base, tag);
+    if (way >= 0) {
+        dirty[base + way] |= dirtyLine;
+        return CacheAccess{true, true, false, false, 0};
+    }
+    CacheAccess result = insert<Policy>(set, tag, dirtyLine);
+    result.hit = false;
+    return result;
+}
+
+template <class Policy>
+CacheAccess Cache::insert(uint64_t set, uint64_t tag, bool dirtyLine) {
+    uint64_t base = set * setStride;
+    // Fill the first invalid way, or let the policy pick a victim.
+    const void* invalid = std::memchr(valid.data() + base, 0, config.ways);
+    uint64_t victim = invalid ? static_cast<const uint8_t*>(invalid) - (valid.data() + base)
+                              : Policy::victim(replacement, set);
+    CacheAccess result{false, true, false, !invalid, 0};
+    if (result.evicted) {
+        result.writeback = dirty[base + victim];
+        result.victimAddress = ((tags[base + victim] << setIndexBits) | set) << blockOffsetBits;
+        if (result.writeback) writebacks++;
+    }
+
+    valid[base + victim] = 1;
+    tags[base + victim] = tag;
+    dirty[base + victim] = dirtyLine;
+    Policy::insert(replacement, set, victim);
+    return result;
+}
+
+bool Cache::probe(uint64_t address) const {
+    return findWay(getSetIndex(address) * setStride, getTag(address)) >= 0;
+}
+
+bool Cache::invalidate(uint64_t address) {
+    uint64_t base = getSetIndex(address) * setStride;
+    int64_t way = findWay(base, getTag(address));
+    if (way < 0) return false;
+    valid[base + way] = 0;
+    bool wasDirty = dirty[base + way];
+    dirty[base + way] = 0;
+    return wasDirty;
+}
+
+void Cache::saveState(std::ostream& out) const {
+    putRaw(out, config.cacheSize);
+    putRaw(out, config.blockSize);
+    putRaw(out, config.ways);
+    putRaw(out, config.replacement);
+    putVector(out, tags);
+    putVector(out, valid);
+    putVector(out, dirty);
+    replacement.saveState(out);
+}
+
+bool Cache::restoreState(std::istream& in) {
+    CacheConfig saved;
+    if (!getRaw(in, saved.cacheSize) || !getRaw(in, saved.blockSize) ||
+        !getRaw(in, saved.ways) || !getRaw(in, saved.replacement)) {
+        return false;
+    }
+    if (saved.cacheSize != config.cacheSize || saved.blockSize != config.blockSize ||
+        saved.ways != config.ways || saved.replacement != config.replacement) {
+        return false;
+    }
+    return getVector(in, tags) && getVector(in, valid) && getVector(in, dirty) &&
+           replacement.restoreState(in);
 }
 
 // debug: dump information as you needed, here are some examples
@@ -65,6 +447,11 @@ Status Cache::dump(const std::string& base_output_name) {
         cache_out << "Block Size: " << config.blockSize << " bytes" << std::endl;
         cache_out << "Ways: " << (config.ways == 1) << std::endl;
         cache_out << "Miss Latency: " << config.missLatency << " cycles" << std::endl;
+        cache_out << "Replacement: " << replacementName(config.replacement) << std::endl;
+        cache_out << "Prefetcher: " << prefetcherName(config.prefetcher) << std::endl;
+        cache_out << "Write policy: " << (config.writeBack ? "write-back" : "write-through")
+                  << (config.writeAllocate ? ", write-allocate" : ", no-write-allocate")
+                  << std::endl;
         cache_out << "---------------------" << endl;
         cache_out << "End Register Values" << endl;
         cache_out << "---------------------" << endl;
@@ -2,8 +2,22 @@
 #include <inttypes.h>
 #include <cmath>
 #include <iostream>
+#include <string>
 #include <vector>
 #include "Utilities.h"
+#include "prefetch.h"
+#include "replacement.h"
+
+// Tags compared per step of the tag match, and the set padding that allows whole-vector
+// loads
+#define CACHE_MATCH_LANES 4
+
+// How an L2 or L3 relates to the levels above it
+enum InclusionPolicy : uint8_t {
+    INCLUSION_NINE,       // fills go into every level, evictions never reach upwards
+    INCLUSION_INCLUSIVE,  // holds every block above it, evictions invalidate upwards
+    INCLUSION_EXCLUSIVE,  // holds only blocks evicted from above, hits move the block up
+};
 
 struct CacheConfig {
     // Cache size in bytes.
@@ -14,17 +28,88 @@ struct CacheConfig {
     uint64_t ways;
     // Additional miss latency in cycles.
     uint64_t missLatency;
+    // Replacement policy once every way of a set is valid.
+    ReplacementPolicy replacement = REPL_LRU;
+    // Seed of the random choices of REPL_RANDOM and REPL_BRRIP.
+    uint64_t seed = 1;
+    // Stores mark lines dirty (write-back) or go straight to memory (write-through).
+    bool writeBack = true;
+    // A store miss brings the block in (write-allocate) or only writes memory.
+    bool writeAllocate = true;
+    // Extra cycles a miss waits when its fill evicts a dirty line.
+    uint64_t writebackLatency = 0;
+    // Cycles a lookup in an L2 or L3 takes; L1 hits are part of the pipeline.
+    uint64_t hitLatency = 0;
+    // Relation of an L2 or L3 to the levels above it.
+    InclusionPolicy inclusion = INCLUSION_NINE;
+    // Misses a non-blocking D-cache keeps in flight; 0 blocks the pipeline on a miss.
+    uint64_t mshrs = 0;
+    // Prefetcher of an L1, the blocks it asks for per trigger and how far ahead.
+    PrefetchKind prefetcher = PREFETCH_NONE;
+    uint64_t prefetchDegree = 1;
+    uint64_t prefetchDistance = 1;
+    // Blocks in the fully associative victim cache beside an L1 (0 for none), and the
+    // cycles a miss that hits there takes to swap the block back in.
+    uint64_t victimEntries = 0;
+    uint64_t victimLatency = 1;
     // debug: Overload << operator to allow easy printing of CacheConfig
-    friend std::ostream& operator<<(std::ostream& os, const CacheConfig& config) {
-        os << "CacheConfig { " << config.cacheSize << ", " << config.blockSize << ", "
-           << config.ways << ", " << config.missLatency << " }";
-        return os;
-    }
+    friend std::ostream& operator<<(std::ostream& os, const CacheConfig& config);
+};
+
+// The levels the split L1s miss into. Without levels an L1 miss costs the L1's
+// missLatency, as in a single-level model.
+struct HierarchyConfig {
+    // shared unified L2, then optionally an L3
+    std::vector<CacheConfig> levels;
+    // Cycles memory behind the last level takes to supply a block.
+    uint64_t memoryLatency = 0;
 };
 
+// "lru", "tree-plru", "bit-plru", "fifo", "random", "srrip", "brrip"
+const char* replacementName(ReplacementPolicy policy);
+// @return false if name is not one of the names above
+bool parseReplacement(const std::string& name, ReplacementPolicy& policy);
+// "nine", "inclusive", "exclusive"
+const char* inclusionName(InclusionPolicy policy);
+
+/** Read the I-cache and D-cache configs from a sim_cycle cache config file: eight
+ * lines holding size, block size, ways and miss latency of the I-cache, then of the
+ * D-cache (anything after the number on a line is a comment). Optional lines after
+ * them set further fields as "<icache|dcache|l2|l3>.<key> <value>", e.g.
+ * "dcache.replacement srrip", "dcache.write write-through", "dcache.allocate no-write",
+ * "dcache.writeback-latency 20", "dcache.mshrs 4", "icache.prefetcher next-line"
+ * (with "prefetch-degree" and "prefetch-distance") or "dcache.victim-entries 8"
+ * (with "victim-latency"); '#' starts a comment.
+ * An L2 or L3 is configured by its "size", "block", "ways" and "latency" (hit
+ * latency) keys plus optionally "inclusion nine|inclusive|exclusive", and needs
+ * "memory.latency <cycles>". Those lines are only accepted if hierarchy is given.
+ * @throw std::invalid_argument if the file cannot be opened or a value is missing
+ */
+void readCacheConfigs(const std::string& fileName, CacheConfig& icConfig, CacheConfig& dcConfig,
+                      HierarchyConfig* hierarchy = nullptr);
+
+// @return an empty string if config describes a cache the simulator can model,
+//      otherwise the reason it cannot
+std::string checkCacheConfig(const CacheConfig& config);
+// checkCacheConfig for every level, and that the levels fit together
+std::string checkHierarchyConfig(const CacheConfig& icConfig, const CacheConfig& dcConfig,
+                                 const HierarchyConfig& hierarchy);
+
 enum CacheDataType { I_CACHE = false, D_CACHE = true };
 enum CacheOperation { CACHE_READ = false, CACHE_WRITE = true };
 
+// What one access did, for the timing model
+struct CacheAccess {
+    bool hit;
+    // the block was brought in; false only for a no-write-allocate store miss
+    bool allocated;
+    // the fill evicted a dirty line that has to be written back first
+    bool writeback;
+    // the fill replaced a valid line, the block at victimAddress
+    bool evicted;
+    uint64_t victimAddress;
+};
+
 class Cache {
 private:
     uint64_t hits, misses;    
@@ -33,15 +118,34 @@ private:
     uint64_t blockOffsetBits;
     uint64_t setIndexBits;
     uint64_t setIndexMask;
-    uint64_t accessCounter = 0;
 
-    struct Line {
-        bool     valid = false;
-        uint64_t tag = 0;
-        uint64_t lastUsed = 0;  // For true LRU
-    };
+    // Tag, valid and dirty state as one array per field, line (set, way) at set * setStride + way.
+    // setStride is ways rounded up to CACHE_MATCH_LANES so the tag compare can read
+    // whole vectors; the padding lines are never valid.
+    uint64_t setStride;
+    std::vector<uint64_t> tags;
+    std::vector<uint8_t> valid;
+    std::vector<uint8_t> dirty;
+    ReplacementState replacement;
+    uint64_t writebacks = 0;     // dirty lines evicted
+    uint64_t writeThroughs = 0;  // stores passed on to memory without a writeback
+
+    // access and fill specialized for config.replacement, picked by the constructor
+    CacheAccess (Cache::*accessFn)(uint64_t address, CacheOperation readWrite, bool allocate);
+    CacheAccess (Cache::*fillFn)(uint64_t address, bool dirtyLine);
 
-    std::vector<std::vector<Line>> sets;
+    // @return the way of the set starting at line base that holds tag, or -1
+    int64_t findWay(uint64_t base, uint64_t tag) const;
+
+    template <class Policy>
+    void initReplacement();
+    template <class Policy>
+    CacheAccess accessWith(uint64_t address, CacheOperation readWrite, bool allocate);
+    template <class Policy>
+    CacheAccess fillWith(uint64_t address, bool dirtyLine);
+    // put tag into the first invalid way of set, or the way the policy evicts
+    template <class Policy>
+    CacheAccess insert(uint64_t set, uint64_t tag, bool dirtyLine);
 
     inline uint64_t getSetIndex(uint64_t address) const {
         return (address >> blockOffsetBits) & setIndexMask;
@@ -57,18 +161,52 @@ public:
     Cache(CacheConfig configParam, CacheDataType cacheType);
 
     /** Access methods for reading/writing
-     * @return true for hit and false for miss
+     * @return whether it hit, and whether it allocated and wrote a dirty line back
      * @param
      *      address: memory address
-     *      readWrite: true for read operation and false for write operation
+     *      readWrite: CACHE_READ or CACHE_WRITE
+     */
+    CacheAccess access(uint64_t address, CacheOperation readWrite) {
+        return (this->*accessFn)(address, readWrite,
+                                 readWrite == CACHE_READ || config.writeAllocate);
+    }
+
+    // A read counted as a hit or miss that never allocates, for exclusive levels
+    CacheAccess lookup(uint64_t address) { return (this->*accessFn)(address, CACHE_READ, false); }
+
+    /** Install the block of address without counting an access, e.g. a victim
+     * moving down into an exclusive level. A block already present only has its
+     * dirty bit or-ed with dirtyLine.
+     * @return the line it evicted, if any
      */
-    bool access(uint64_t address, CacheOperation readWrite);
+    CacheAccess fill(uint64_t address, bool dirtyLine) {
+        return (this->*fillFn)(address, dirtyLine);
+    }
+
+    // @return whether the block of address is present, without touching any state
+    bool probe(uint64_t address) const;
+
+    /** Drop the block of address, if present
+     * @return whether it was present and dirty
+     */
+    bool invalidate(uint64_t address);
 
     // debug: dump information as you needed
     Status dump(const std::string& base_output_name);
 
+    // Write the tags, valid and dirty bits and replacement state to a checkpoint, or
+    // read them back; the hit and miss counters are not part of it
+    void saveState(std::ostream& out) const;
+    // @return false if the checkpoint was taken with another geometry or policy
+    bool restoreState(std::istream& in);
+
+    // Zero the counters below, keeping the contents
+    void resetStats() { hits = misses = writebacks = writeThroughs = 0; }
+
     // TODO: You may add more methods and fields as needed
 
     uint64_t getHits() { return hits; }
     uint64_t getMisses() { return misses; }
+    uint64_t getWritebacks() { return writebacks; }
+    uint64_t getWriteThroughs() { return writeThroughs; }
 };
@@ -0,0 +1,51 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'C', 'K', 'P', 'T', '0', '1'};
+
+Status writeCheckpoint(const std::string& path, const CheckpointSections& sections) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << LOG_ERROR << "Could not create checkpoint " << path << std::endl;
+        return ERROR;
+    }
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    for (const auto& section : sections) {
+        putRaw(out, section.first);
+        putRaw(out, static_cast<uint64_t>(section.second.size()));
+        out.write(section.second.data(), section.second.size());
+    }
+    if (!out) {
+        std::cerr << LOG_ERROR << "Could not write checkpoint " << path << std::endl;
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+Status readCheckpoint(const std::string& path, CheckpointSections& sections) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    if (!in || !in.read(magic, sizeof(magic)) ||
+        std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+        std::cerr << LOG_ERROR << "Not a checkpoint: " << path << std::endl;
+        return ERROR;
+    }
+    // lengths come from the file, so check them against what is left of it
+    std::streamoff end = in.seekg(0, std::ios::end).tellg();
+    in.seekg(sizeof(CHECKPOINT_MAGIC));
+    uint32_t tag;
+    while (getRaw(in, tag)) {
+        uint64_t length = 0;
+        bool fits = getRaw(in, length) && length <= static_cast<uint64_t>(end - in.tellg());
+        std::string& payload = sections[tag];
+        if (fits) payload.resize(length);
+        if (!fits || !in.read(&payload[0], length)) {
+            std::cerr << LOG_ERROR << "Truncated checkpoint " << path << std::endl;
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <inttypes.h>
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Utilities.h"
+
+/** Checkpoint files: the magic "RVCKPT01", then tagged sections, each a 4-byte tag,
+ * an 8-byte length and that many bytes of payload. Values are stored in host byte
+ * order. A reader skips the sections it has no use for, so a functional run can
+ * restore a checkpoint the cycle simulator took along with its caches and pipeline.
+ */
+enum CheckpointSection : uint32_t {
+    SECTION_ARCH = 1,      // PC, din, registers and memory
+    SECTION_CACHES = 2,    // tags, valid and dirty bits and replacement state of each cache
+    SECTION_PIPELINE = 3,  // latches and miss state of the scalar pipeline
+};
+
+typedef std::map<uint32_t, std::string> CheckpointSections;
+
+// Write sections to path
+Status writeCheckpoint(const std::string& path, const CheckpointSections& sections);
+// Read every section of the checkpoint at path
+Status readCheckpoint(const std::string& path, CheckpointSections& sections);
+
+// What sim_funct and sim_cycle save and restore
+struct CheckpointConfig {
+    std::string restore;  // checkpoint to start from, if not empty
+    std::string save;     // checkpoint to take, if not empty
+    uint64_t saveAt = 0;  // instructions (sim_funct) or cycles (sim_cycle) before it is taken
+    bool caches = false;    // sim_cycle: also save the cache contents
+    bool pipeline = false;  // sim_cycle: also save the scalar pipeline's latches
+};
+
+// Fixed-size values and vectors of them, as the payload of a section
+
+template <typename T>
+void putRaw(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool getRaw(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+template <typename T>
+void putVector(std::ostream& out, const std::vector<T>& values) {
+    putRaw(out, static_cast<uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+// @return false unless the stream holds exactly values.size() elements next
+template <typename T>
+bool getVector(std::istream& in, std::vector<T>& values) {
+    uint64_t size;
+    if (!getRaw(in, size) || size != values.size()) return false;
+    return static_cast<bool>(
+        in.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(T)));
+}
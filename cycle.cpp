@@ -1,28 +1,23 @@
 #include "cycle.h"
 
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 #include "Utilities.h"
 #include "cache.h"
 #include "simulator.h"
 
-static Simulator* simulator = nullptr;
-static Cache* iCache = nullptr;
-static Cache* dCache = nullptr;
-static std::string output;
-
-static uint64_t cycleCount = 0;
-static uint64_t loadUseStalls = 0;
-static uint64_t PC = 0;
-
 static const uint64_t EXCEPTION_HANDLER_ADDR = 0x8000;
 
-// Cache miss tracking
-static bool iMissActive = false;
-static int64_t iMissRemaining = 0;
-static bool dMissActive = false;
-static int64_t dMissRemaining = 0;
+const uint64_t CycleSimulator::NO_PRODUCER;
+
+// Simulation behind the initSimulator()/runCycles()/finalizeSimulator() API
+static CycleSimulator* defaultSimulator = nullptr;
 
 Simulator::Instruction nop(StageStatus status) {
     Simulator::Instruction inst;
@@ -33,15 +28,42 @@ Simulator::Instruction nop(StageStatus status) {
     return inst;
 }
 
-struct PipelineInfo {
-    Simulator::Instruction ifInst = nop(IDLE);
-    Simulator::Instruction idInst = nop(IDLE);
-    Simulator::Instruction exInst = nop(IDLE);
-    Simulator::Instruction memInst = nop(IDLE);
-    Simulator::Instruction wbInst = nop(IDLE);
+// Trace policies runCycles is specialized on. capture() decides at the start of a cycle
+// whether its pipe state is recorded; with eventsOnly the recorded state is only written
+// once the cycle turned out to stall, squash or trap. TraceOff compiles all of it away.
+struct TraceOff {
+    static const bool enabled = false;
+    static const bool eventsOnly = false;
+    static bool capture(const TraceConfig&, uint64_t) { return false; }
 };
 
-static PipelineInfo pipelineInfo;
+struct TraceAll {
+    static const bool enabled = true;
+    static const bool eventsOnly = false;
+    static bool capture(const TraceConfig&, uint64_t) { return true; }
+};
+
+struct TraceWindow {
+    static const bool enabled = true;
+    static const bool eventsOnly = false;
+    static bool capture(const TraceConfig& config, uint64_t cycle) {
+        return cycle >= config.windowStart && cycle < config.windowEnd;
+    }
+};
+
+struct TraceSampled {
+    static const bool enabled = true;
+    static const bool eventsOnly = false;
+    static bool capture(const TraceConfig& config, uint64_t cycle) {
+        return cycle % config.interval == 0;
+    }
+};
+
+struct TraceEvents {
+    static const bool enabled = true;
+    static const bool eventsOnly = true;
+    static bool capture(const TraceConfig&, uint64_t) { return true; }
+};
 
 // Check if instruction is valid (not bubble/squashed/idle)
 static bool isValidInst(const Simulator::Instruction& inst) {
@@ -76,67 +98,192 @@ static uint64_t forwardValue(const Simulator::Instruction& inst,
     return orig;
 }
 
-Status initSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig, MemoryStore* mem,
-                     const std::string& output_name) {
-    output = output_name;
+// Pipe state shown at the start of a cycle
+static PipeState snapshot(const PipelineInfo& latch, uint64_t cycle) {
+    PipeState state{};
+    state.cycle = cycle;
+    state.ifPC = latch.ifInst.PC;
+    state.ifStatus = latch.ifInst.status;
+    state.idInstr = latch.idInst.instruction;
+    state.idStatus = latch.idInst.status;
+    state.exInstr = latch.exInst.instruction;
+    state.exStatus = latch.exInst.status;
+    state.memInstr = latch.memInst.instruction;
+    state.memStatus = latch.memInst.status;
+    state.wbInstr = latch.wbInst.instruction;
+    state.wbStatus = latch.wbInst.status;
+    return state;
+}
+
+static bool isBubbleNop(const Simulator::Instruction& inst) {
+    return inst.status == BUBBLE && inst.instruction == 0x00000013;
+}
+
+// A legal branch, JAL or JALR, the only instructions the predictor resolves
+static bool isControl(const Simulator::Instruction& inst) {
+    return inst.isLegal && !inst.isNop && !inst.isHalt &&
+           (inst.opcode == OP_BRANCH || inst.opcode == OP_JAL || inst.opcode == OP_JALR);
+}
+
+// Number of upcoming cycles (including this one) in which the pipeline stays frozen
+// waiting for a cache miss, nothing touches a cache or the stall counters, and the pipe
+// state repeats unchanged:
+//  - a D-cache miss: IF/ID/EX hold and MEM and WB only pass bubbles
+//  - an I-cache miss once ID, EX, MEM and WB all hold the same bubble, which every
+//    stage then passes on
+// Only the miss counters move, so these cycles can be skipped in one step.
+uint64_t CycleSimulator::frozenCycles(const PipelineInfo& old) const {
+    const Simulator::Instruction& id = old.idInst;
+    if (dMissActive) {
+        if (dMissRemaining < 2) return 0;
+        if (!isBubbleNop(old.memInst) || !isBubbleNop(old.wbInst)) return 0;
+        if (isValidInst(id) && !id.isNop && !id.isHalt && !id.isLegal) return 0;  // illegal trap
+        // the cycle that counts the miss down to 0 completes the access
+        return static_cast<uint64_t>(dMissRemaining) - 1;
+    }
+    // MSHRs retire and count their busy cycles every cycle
+    if (!iMissActive || iMissRemaining < 2 || !mshrs.empty() || isValidInst(id)) return 0;
+    for (const Simulator::Instruction* stage : {&old.exInst, &old.memInst, &old.wbInst}) {
+        if (isValidInst(*stage) || stage->status != id.status ||
+            stage->instruction != id.instruction) {
+            return 0;
+        }
+    }
+    return static_cast<uint64_t>(iMissRemaining) - 1;
+}
+
+CycleSimulator::CycleSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig,
+                               MemoryStore* mem, const std::string& output_name,
+                               const TraceConfig& trace, const CoreConfig& core,
+                               const HierarchyConfig& hierarchy)
+    : output(output_name),
+      traceConfig(trace),
+      coreConfig(core),
+      nonBlocking(dCacheConfig.mshrs > 0) {
     simulator = new Simulator();
     simulator->setMemory(mem);
     iCache = new Cache(iCacheConfig, I_CACHE);
     dCache = new Cache(dCacheConfig, D_CACHE);
+    caches = new CacheHierarchy(iCache, dCache, hierarchy);
+    if (coreConfig.classifyMisses) caches->classifyMisses();
+    if (traceConfig.mode == TRACE_SAMPLED && traceConfig.interval == 0) traceConfig.interval = 1;
+    if (traceConfig.mode != TRACE_OFF) pipeTrace.open(output, traceConfig.format);
+    if (coreConfig.missCurves) {
+        iProfile = new StackDistanceProfiler(iCacheConfig.blockSize);
+        dProfile = new StackDistanceProfiler(dCacheConfig.blockSize);
+    }
+    if (coreConfig.predictor.kind != PREDICT_NONE) {
+        predictor = new BranchPredictor(coreConfig.predictor);
+    }
+    latches[0].ifInst.PC = 0;
+    if (coreConfig.width > 1 || coreConfig.outOfOrder) {
+        issueHistogram.assign(coreConfig.width + 1, 0);
+    }
+    std::fill(std::begin(ooo.renameMap), std::end(ooo.renameMap), NO_PRODUCER);
+}
 
-    PC = 0;
-    cycleCount = 0;
-    loadUseStalls = 0;
-    iMissActive = dMissActive = false;
-    iMissRemaining = dMissRemaining = 0;
+CycleSimulator::~CycleSimulator() {
+    delete simulator;
+    delete caches;
+    delete iCache;
+    delete dCache;
+    delete iProfile;
+    delete dProfile;
+    delete predictor;
+}
 
-    pipelineInfo = {};
-    pipelineInfo.ifInst = nop(IDLE);
-    pipelineInfo.ifInst.PC = 0;
-    pipelineInfo.idInst = nop(IDLE);
-    pipelineInfo.exInst = nop(IDLE);
-    pipelineInfo.memInst = nop(IDLE);
-    pipelineInfo.wbInst = nop(IDLE);
-    return SUCCESS;
+bool CycleSimulator::accessNonBlocking(const Simulator::Instruction& inst, uint64_t& readyAt) {
+    uint64_t block = inst.memAddress & ~(dCache->config.blockSize - 1);
+    CacheOperation op = inst.writesMem ? CACHE_WRITE : CACHE_READ;
+    readyAt = 0;
+
+    auto inFlight = std::find_if(mshrs.begin(), mshrs.end(),
+                                 [&](const Mshr& m) { return m.block == block; });
+    if (inFlight != mshrs.end()) {
+        // secondary miss: the tags already hold the block, the data comes with the fill
+        if (dProfile) dProfile->access(inst.memAddress);
+        caches->access(D_CACHE, inst.memAddress, op, inst.PC, cacheClock());
+        mshrMerges++;
+        readyAt = inFlight->readyAt;
+    } else {
+        if (mshrs.size() >= dCache->config.mshrs && !dCache->probe(inst.memAddress)) return false;
+        if (dProfile) dProfile->access(inst.memAddress);
+        MemoryAccess result = caches->access(D_CACHE, inst.memAddress, op, inst.PC, cacheClock());
+        if (!result.stall) return true;
+        readyAt = cycleCount + result.latency;
+        mshrs.push_back(Mshr{block, readyAt});
+        mshrMisses++;
+    }
+    if (inst.readsMem && inst.writesRd && inst.rd != 0) {
+        regReadyAt[inst.rd] = std::max(regReadyAt[inst.rd], readyAt);
+    }
+    return true;
 }
 
-Status runCycles(uint64_t cycles) {
+template <typename Trace>
+Status CycleSimulator::runCyclesTraced(uint64_t cycles) {
     uint64_t executed = 0;
     Status status = SUCCESS;
 
     while (cycles == 0 || executed < cycles) {
+        const PipelineInfo& old = latches[current];
+        PipelineInfo& next = latches[current ^ 1];
+
+        if (coreConfig.skipStalls) {
+            uint64_t skip = frozenCycles(old);
+            if (cycles != 0) skip = std::min(skip, cycles - executed);
+            if (skip > 0) {
+                // Every skipped cycle is a stall cycle, so event traces record it too
+                if (Trace::enabled) {
+                    PipeState frozen = snapshot(old, 0);
+                    for (uint64_t cycle = cycleCount; cycle < cycleCount + skip; cycle++) {
+                        if (!Trace::capture(traceConfig, cycle)) continue;
+                        frozen.cycle = cycle;
+                        pipeTrace.write(frozen);
+                    }
+                }
+                executed += skip;
+                cycleCount += skip;
+                if (dMissActive) dMissRemaining -= static_cast<int64_t>(skip);
+                if (iMissActive) iMissRemaining = std::max<int64_t>(0, iMissRemaining - skip);
+                continue;
+            }
+        }
+
         executed++;
 
         // Dump pipe state at the beginning of each cycle
         PipeState pipeState{};
-        pipeState.cycle = cycleCount;
-        pipeState.ifPC = pipelineInfo.ifInst.PC;
-        pipeState.ifStatus = pipelineInfo.ifInst.status;
-        pipeState.idInstr = pipelineInfo.idInst.instruction;
-        pipeState.idStatus = pipelineInfo.idInst.status;
-        pipeState.exInstr = pipelineInfo.exInst.instruction;
-        pipeState.exStatus = pipelineInfo.exInst.status;
-        pipeState.memInstr = pipelineInfo.memInst.instruction;
-        pipeState.memStatus = pipelineInfo.memInst.status;
-        pipeState.wbInstr = pipelineInfo.wbInst.instruction;
-        pipeState.wbStatus = pipelineInfo.wbInst.status;
-        dumpPipeState(pipeState, output);
+        bool traced = Trace::enabled && Trace::capture(traceConfig, cycleCount);
+        if (traced) {
+            pipeState = snapshot(old, cycleCount);
+            if (!Trace::eventsOnly) pipeTrace.write(pipeState);
+        }
 
         cycleCount++;
 
-        PipelineInfo old = pipelineInfo;
-        PipelineInfo next{nop(BUBBLE), nop(BUBBLE), nop(BUBBLE), nop(BUBBLE), nop(BUBBLE)};
-
         // Decrement cache miss counters at start of cycle
         if (iMissActive && iMissRemaining > 0) iMissRemaining--;
         if (dMissActive && dMissRemaining > 0) dMissRemaining--;
 
+        // Retire non-blocking misses whose data arrived
+        if (!mshrs.empty()) {
+            mshrs.erase(std::remove_if(mshrs.begin(), mshrs.end(),
+                                       [&](const Mshr& m) { return m.readyAt < cycleCount; }),
+                        mshrs.end());
+            mshrBusyCycles += !mshrs.empty();
+            mshrOccupancy += mshrs.size();
+        }
+
         // ===== WB Stage =====
         // WB consumes the MEM stage output (old.memInst). When the MEM stage is stalled,
         // old.memInst must NOT be held (or we would commit the same instruction repeatedly).
-        next.wbInst = simulator->simWB(old.memInst);
+        // Every path below writes all five latches of next.
+        next.wbInst = old.memInst;
+        simulator->simWB(next.wbInst);
         if (next.wbInst.isHalt && isValidInst(next.wbInst)) {
-            pipelineInfo = next;
+            next.ifInst = next.idInst = next.exInst = next.memInst = nop(BUBBLE);
+            current ^= 1;
             status = HALT;
             break;
         }
@@ -185,8 +332,27 @@ Status runCycles(uint64_t cycles) {
             }
         }
 
+        // ===== Non-blocking D-cache: wait for registers of loads still missing =====
+        // Writers wait as well, so a late fill never overwrites a younger result
+        bool missWait = false;
+        if (nonBlocking && isValidInst(old.idInst) && !old.idInst.isNop && !old.idInst.isHalt) {
+            auto pending = [&](uint64_t reg) { return reg != 0 && regReadyAt[reg] >= cycleCount; };
+            missWait = (old.idInst.readsRs1 && pending(old.idInst.rs1)) ||
+                       (old.idInst.readsRs2 && pending(old.idInst.rs2)) ||
+                       (old.idInst.writesRd && pending(old.idInst.rd));
+        }
+
+        // ===== ROI markers serialize =====
+        // Nothing enters EX behind an ROI marker until the cycle after it retired, so a
+        // region ends with the marker
+        auto isMarker = [](const Simulator::Instruction& inst) {
+            return isValidInst(inst) && inst.roiMarker != ROI_NONE;
+        };
+        bool markerDrain = isMarker(old.exInst) || isMarker(old.memInst);
+
         bool branchStall = branchStallCycles > 0;
-        bool pipelineStall = loadUseHazard || branchStall || dMissStall;
+        bool pipelineStall = loadUseHazard || branchStall || dMissStall || missWait || markerDrain;
+        if (missWait && !loadUseHazard) missWaitStalls++;
 
         // Count load-use stalls (load-use and load-branch both count once)
         bool countLoadStall = false;
@@ -219,7 +385,9 @@ Status runCycles(uint64_t cycles) {
             PC = EXCEPTION_HANDLER_ADDR;
             iMissActive = dMissActive = false;
             iMissRemaining = dMissRemaining = 0;
-            pipelineInfo = next;
+            if (predictor) predictor->squash();
+            current ^= 1;
+            if (Trace::eventsOnly && traced) pipeTrace.write(pipeState);
             continue;
         }
 
@@ -229,18 +397,23 @@ Status runCycles(uint64_t cycles) {
         // emit bubbles from MEM until the miss resolves.
         bool startDMiss = false;
         bool dStallThisCycle = dMissStall;
+        // a miss that found every MSHR busy retries from EX/MEM with its forwarded data
+        bool mshrStall = false;
+        Simulator::Instruction mshrHeld;
 
         if (dMissActive) {
             if (dMissRemaining == 0) {
                 // D-cache miss resolved: complete the memory access for the held instruction.
-                next.memInst = simulator->simMEM(old.exInst);
+                next.memInst = old.exInst;
+                simulator->simMEM(next.memInst);
                 dMissActive = false;
             } else {
                 // Still waiting: no new MEM output this cycle.
                 next.memInst = nop(BUBBLE);
             }
         } else {
-            auto memCandidate = old.exInst;
+            Simulator::Instruction& memCandidate = next.memInst;
+            memCandidate = old.exInst;
 
             // Store data forwarding for stores reaching MEM (use the value that is being written
             // back this cycle from old.memInst rather than old.wbInst output).
@@ -252,31 +425,47 @@ Status runCycles(uint64_t cycles) {
                 }
             }
 
-            if (isValidInst(memCandidate) && memCandidate.isLegal &&
-                (memCandidate.readsMem || memCandidate.writesMem)) {
-                bool hit = dCache->access(memCandidate.memAddress,
-                                          memCandidate.writesMem ? CACHE_WRITE : CACHE_READ);
-                if (!hit) {
+            bool memAccess = isValidInst(memCandidate) && memCandidate.isLegal &&
+                             (memCandidate.readsMem || memCandidate.writesMem);
+            if (memAccess && nonBlocking) {
+                uint64_t readyAt;
+                mshrStall = !accessNonBlocking(memCandidate, readyAt);
+                if (mshrStall) {
+                    mshrFullStalls++;
+                    mshrHeld = memCandidate;
+                    memCandidate = nop(BUBBLE);
+                }
+            } else if (memAccess) {
+                if (dProfile) dProfile->access(memCandidate.memAddress);
+                MemoryAccess result = caches->access(
+                    D_CACHE, memCandidate.memAddress,
+                    memCandidate.writesMem ? CACHE_WRITE : CACHE_READ, memCandidate.PC,
+                    cacheClock());
+                // a no-write-allocate store miss goes around the cache without waiting
+                if (result.stall) {
                     startDMiss = true;
                     dMissActive = true;
-                    dMissRemaining = static_cast<int64_t>(dCache->config.missLatency);
-                    next.memInst = nop(BUBBLE);
+                    dMissRemaining = static_cast<int64_t>(result.latency);
+                    memCandidate = nop(BUBBLE);
                 }
             }
 
-            if (!startDMiss) {
-                next.memInst = simulator->simMEM(memCandidate);
+            if (!startDMiss && !mshrStall) {
+                simulator->simMEM(memCandidate);
             }
         }
 
-        dStallThisCycle = dStallThisCycle || startDMiss;
+        dStallThisCycle = dStallThisCycle || startDMiss || mshrStall;
 
         // ===== EX Stage =====
         if (!pipelineStall && !illegalTrap && !dStallThisCycle) {
-            auto idInst = old.idInst;
+            Simulator::Instruction& idInst = next.exInst;
+            idInst = old.idInst;
 
             // Apply forwarding for EX stage
             if (isValidInst(idInst) && !idInst.isNop && !idInst.isHalt) {
+                // a load that missed may have committed while this waited in ID
+                if (nonBlocking && idInst.isLegal) simulator->simOperandCollection(idInst);
                 if (idInst.readsRs1) {
                     idInst.op1Val =
                         forwardValue(idInst, old.exInst, old.memInst, old.wbInst, idInst.op1Val, true);
@@ -287,24 +476,27 @@ Status runCycles(uint64_t cycles) {
                 }
             }
 
-            next.exInst = simulator->simEX(idInst);
+            simulator->simEX(idInst);
         } else if (dStallThisCycle) {
             // Hold the miss-causing instruction in EX/MEM while D-cache miss is in progress.
-            next.exInst = old.exInst;
+            next.exInst = mshrStall ? mshrHeld : old.exInst;
         } else {
             next.exInst = nop(BUBBLE);
         }
 
         // ===== ID Stage and Branch Resolution =====
-        bool branchTaken = false;
-        uint64_t branchTarget = 0;
+        // IF fetched down inst.predictedPC; ID redirects it when that was wrong
+        bool redirect = false;
+        uint64_t redirectPC = 0;
         bool iStall = iMissActive && iMissRemaining > 0;
 
         if (!pipelineStall && !iStall && !dStallThisCycle) {
-            auto ifInst = old.ifInst;
+            Simulator::Instruction& ifInst = next.idInst;
+            ifInst = old.ifInst;
 
             if (isValidInst(ifInst)) {
-                ifInst = simulator->simID(ifInst);
+                simulator->simID(ifInst);
+                if (predictor && !isControl(ifInst)) predictor->notControl(ifInst.PC);
 
                 // Handle speculative status - clear when entering ID
                 if (ifInst.status == SPECULATIVE) {
@@ -312,30 +504,33 @@ Status runCycles(uint64_t cycles) {
                 }
 
                 // Branch/Jump resolution in ID
-                if (ifInst.isLegal && !ifInst.isNop && !ifInst.isHalt &&
-                    (ifInst.opcode == OP_BRANCH || ifInst.opcode == OP_JALR ||
-                     ifInst.opcode == OP_JAL)) {
-
-                    // Apply forwarding for branch operands
-                    if (ifInst.readsRs1) {
-                        ifInst.op1Val =
-                            forwardValue(ifInst, old.exInst, old.memInst, old.wbInst, ifInst.op1Val, true);
-                    }
-                    if (ifInst.readsRs2) {
-                        ifInst.op2Val =
-                            forwardValue(ifInst, old.exInst, old.memInst, old.wbInst, ifInst.op2Val, false);
-                    }
+                if (ifInst.isLegal && !ifInst.isNop && !ifInst.isHalt) {
+                    uint64_t actualPC = ifInst.PC + 4;
+                    if (ifInst.opcode == OP_BRANCH || ifInst.opcode == OP_JALR ||
+                        ifInst.opcode == OP_JAL) {
+                        // Apply forwarding for branch operands
+                        if (ifInst.readsRs1) {
+                            ifInst.op1Val = forwardValue(ifInst, old.exInst, old.memInst,
+                                                         old.wbInst, ifInst.op1Val, true);
+                        }
+                        if (ifInst.readsRs2) {
+                            ifInst.op2Val = forwardValue(ifInst, old.exInst, old.memInst,
+                                                         old.wbInst, ifInst.op2Val, false);
+                        }
 
-                    ifInst = simulator->simNextPCResolution(ifInst);
+                        simulator->simNextPCResolution(ifInst);
+                        actualPC = ifInst.nextPC;
+                        // a branch squashed by the trap below never resolves
+                        if (predictor && !illegalTrap) predictor->resolve(ifInst);
+                        ifInst.status = NORMAL;
+                    }
 
-                    if (ifInst.nextPC != ifInst.PC + 4) {
-                        branchTaken = true;
-                        branchTarget = ifInst.nextPC;
+                    if (actualPC != ifInst.predictedPC) {
+                        redirect = true;
+                        redirectPC = actualPC;
                     }
-                    ifInst.status = NORMAL;
                 }
             }
-            next.idInst = ifInst;
         } else {
             next.idInst = old.idInst;
         }
@@ -347,15 +542,16 @@ Status runCycles(uint64_t cycles) {
             if (iMissActive) {
                 if (iMissRemaining == 0) {
                     // I-cache miss just resolved
-                    auto fetched = simulator->simIF(PC);
+                    Simulator::Instruction& fetched = next.ifInst;
+                    simulator->simIF(PC, fetched);
+                    fetched.predictedPC = predictor ? predictor->predict(PC) : PC + 4;
 
                     bool parentCtrl =
                         (old.idInst.opcode == OP_BRANCH || old.idInst.opcode == OP_JALR ||
                          old.idInst.opcode == OP_JAL) &&
                         isValidInst(old.idInst);
                     fetched.status = parentCtrl ? SPECULATIVE : NORMAL;
-                    next.ifInst = fetched;
-                    PC = PC + 4;
+                    PC = fetched.predictedPC;
                     iMissActive = false;
                 } else {
                     // Still waiting for I-cache
@@ -366,39 +562,44 @@ Status runCycles(uint64_t cycles) {
                 // Try to fetch
                 uint64_t fetchPC = PC;
 
-                bool hit = iCache->access(fetchPC, CACHE_READ);
-                if (!hit) {
+                if (iProfile) iProfile->access(fetchPC);
+                MemoryAccess result = caches->access(I_CACHE, fetchPC, CACHE_READ, fetchPC,
+                                                     cacheClock());
+                // a late prefetch hits in the tags but still waits for its data
+                if (result.stall) {
                     // Start I-cache miss
                     iMissActive = true;
-                    iMissRemaining = static_cast<int64_t>(iCache->config.missLatency);
+                    iMissRemaining = static_cast<int64_t>(result.latency);
                     next.ifInst = old.ifInst;
                     next.ifInst.status = BUBBLE;
                     next.ifInst.PC = fetchPC;
                 } else {
                     // I-cache hit - fetch succeeds
-                    auto fetched = simulator->simIF(fetchPC);
+                    Simulator::Instruction& fetched = next.ifInst;
+                    simulator->simIF(fetchPC, fetched);
+                    fetched.predictedPC = predictor ? predictor->predict(fetchPC) : fetchPC + 4;
 
                     bool parentCtrl =
                         (old.idInst.opcode == OP_BRANCH || old.idInst.opcode == OP_JALR ||
                          old.idInst.opcode == OP_JAL) &&
                         isValidInst(old.idInst);
                     fetched.status = parentCtrl ? SPECULATIVE : NORMAL;
-                    next.ifInst = fetched;
-                    PC = fetchPC + 4;
+                    PC = fetched.predictedPC;
                 }
             }
         } else {
             next.ifInst = old.ifInst;
         }
 
-        // ===== Handle Branch Taken =====
-        if (branchTaken) {
-            PC = branchTarget;
+        // ===== Handle Branch Taken or Mispredicted =====
+        if (redirect) {
+            PC = redirectPC;
             next.ifInst = nop(SQUASHED);
-            next.ifInst.PC = branchTarget;
+            next.ifInst.PC = redirectPC;
             // Cancel I-cache miss on wrong path
             iMissActive = false;
             iMissRemaining = 0;
+            if (predictor) predictor->squash();
         }
 
         // ===== Handle Illegal Instruction =====
@@ -410,32 +611,1089 @@ Status runCycles(uint64_t cycles) {
             PC = EXCEPTION_HANDLER_ADDR;
             iMissActive = false;
             iMissRemaining = 0;
+            if (predictor) predictor->squash();
+        }
+
+        if (Trace::eventsOnly && traced &&
+            (pipelineStall || dStallThisCycle || iMissActive || redirect || illegalTrap)) {
+            pipeTrace.write(pipeState);
         }
 
-        pipelineInfo = next;
+        current ^= 1;
     }
 
     return status;
 }
 
-Status runTillHalt() {
-    Status status;
-    while (true) {
-        status = static_cast<Status>(runCycles(1));
-        if (status == HALT) break;
+void CycleSimulator::fetchGroup() {
+    uint64_t blockEnd = (PC & ~(iCache->config.blockSize - 1)) + iCache->config.blockSize;
+    while (wide.ifGroup.size() < coreConfig.width) {
+        uint64_t fetchPC = PC;
+        wide.ifGroup.emplace_back();
+        Simulator::Instruction& fetched = wide.ifGroup.back();
+        simulator->simIF(fetchPC, fetched);
+        fetched.predictedPC = predictor ? predictor->predict(fetchPC) : fetchPC + 4;
+        PC = fetched.predictedPC;
+        // a predicted-taken control instruction ends the group, and so does the block
+        if (PC != fetchPC + 4 || PC >= blockEnd) break;
+    }
+}
+
+// In-order superscalar pipeline. IF fetches a group per I-cache access, ID decodes it
+// once the previous group has issued, and issue sends the longest prefix of the ID group
+// to EX that has no operand written earlier in the prefix, no operand a load one stage
+// ahead still has to bring, at most one load or store and at most one control
+// instruction. Operands are read at issue, after WB retired its group, and forwarded
+// from the group ahead. Control instructions resolve at issue, so a wrong prediction
+// squashes ID and IF and fetch restarts the next cycle. A D-cache miss holds the EX
+// group and freezes the stages before it, as in the scalar pipeline.
+template <typename Trace>
+Status CycleSimulator::runWideCyclesTraced(uint64_t cycles) {
+    uint64_t executed = 0;
+    Status status = SUCCESS;
+    const uint64_t width = coreConfig.width;
+    auto head = [](const std::vector<Simulator::Instruction>& group) {
+        return group.empty() ? nop(BUBBLE) : group.front();
+    };
+
+    while (cycles == 0 || executed < cycles) {
+        executed++;
+
+        // Dump the oldest instruction of each stage at the beginning of each cycle
+        PipeState pipeState{};
+        bool traced = Trace::enabled && Trace::capture(traceConfig, cycleCount);
+        if (traced) {
+            PipelineInfo heads;
+            heads.ifInst = head(wide.ifGroup);
+            if (wide.ifGroup.empty()) heads.ifInst.PC = PC;
+            heads.idInst = head(wide.idGroup);
+            heads.exInst = head(wide.exGroup);
+            heads.memInst = head(wide.memGroup);
+            heads.wbInst = wide.wbHead;
+            pipeState = snapshot(heads, cycleCount);
+            if (!Trace::eventsOnly) pipeTrace.write(pipeState);
+        }
+
+        cycleCount++;
+
+        if (iMissActive && iMissRemaining > 0) iMissRemaining--;
+        if (dMissActive && dMissRemaining > 0) dMissRemaining--;
+
+        // ===== WB Stage =====
+        // Retire the MEM group in order; nothing younger than a fault or a halt retires
+        bool memTrap = false;
+        bool halted = false;
+        bool markerRetired = false;
+        wide.wbHead = head(wide.memGroup);
+        for (Simulator::Instruction& inst : wide.memGroup) {
+            if (inst.memException) {
+                memTrap = true;
+                break;
+            }
+            simulator->simWB(inst);
+            markerRetired = markerRetired || inst.roiMarker != ROI_NONE;
+            if (inst.isHalt) {
+                halted = true;
+                break;
+            }
+        }
+        wide.memGroup.clear();
+        if (halted) {
+            status = HALT;
+            break;
+        }
+
+        if (memTrap) {
+            wide.ifGroup.clear();
+            wide.idGroup.clear();
+            wide.exGroup.clear();
+            PC = EXCEPTION_HANDLER_ADDR;
+            iMissActive = dMissActive = false;
+            iMissRemaining = dMissRemaining = 0;
+            if (predictor) predictor->squash();
+            issueHistogram[0]++;
+            if (Trace::eventsOnly && traced) pipeTrace.write(pipeState);
+            continue;
+        }
+
+        // ===== MEM Stage =====
+        // The EX group has at most one load or store; on a miss the group waits in EX
+        bool dStall = false;
+        if (dMissActive) {
+            dStall = dMissRemaining > 0;
+            if (!dStall) dMissActive = false;
+        } else {
+            for (const Simulator::Instruction& inst : wide.exGroup) {
+                if (!inst.isLegal || inst.isHalt || !(inst.readsMem || inst.writesMem)) continue;
+                if (dProfile) dProfile->access(inst.memAddress);
+                MemoryAccess result =
+                    caches->access(D_CACHE, inst.memAddress,
+                                   inst.writesMem ? CACHE_WRITE : CACHE_READ, inst.PC,
+                                   cacheClock());
+                if (result.stall) {
+                    dMissActive = dStall = true;
+                    dMissRemaining = static_cast<int64_t>(result.latency);
+                }
+            }
+        }
+        if (!dStall) {
+            for (Simulator::Instruction& inst : wide.exGroup) simulator->simMEM(inst);
+            wide.memGroup.swap(wide.exGroup);
+        }
+
+        // ===== Issue (ID to EX) =====
+        uint64_t issued = 0;
+        bool cut = false;
+        bool redirect = false;
+        uint64_t redirectPC = 0;
+        bool illegalTrap = false;
+        // memGroup now holds the group that was in EX at the start of the cycle
+        const std::vector<Simulator::Instruction>& ahead = wide.memGroup;
+        // an ROI marker is serializing: nothing issues behind it until the cycle after it
+        // retired, so a region ends with the marker's group
+        bool draining = markerRetired ||
+                        std::any_of(ahead.begin(), ahead.end(), [](const Simulator::Instruction& inst) {
+                            return inst.roiMarker != ROI_NONE;
+                        });
+        if (!dStall && !draining) {
+            bool memPortUsed = false;
+            bool branchUsed = false;
+            while (issued < wide.idGroup.size() && issued < width) {
+                Simulator::Instruction& inst = wide.idGroup[issued];
+                bool active = !inst.isNop && !inst.isHalt;
+                if (active && !inst.isLegal) {
+                    // the illegal instruction traps once everything older has issued
+                    illegalTrap = issued == 0;
+                    break;
+                }
+                auto reads = [&](const Simulator::Instruction& producer) {
+                    if (!producer.writesRd || producer.rd == 0) return false;
+                    return (inst.readsRs1 && producer.rd == inst.rs1) ||
+                           (inst.readsRs2 && producer.rd == inst.rs2);
+                };
+                bool control = active && (inst.opcode == OP_BRANCH || inst.opcode == OP_JAL ||
+                                          inst.opcode == OP_JALR);
+                bool memory = active && (inst.readsMem || inst.writesMem);
+
+                if (active && std::any_of(wide.idGroup.begin(), wide.idGroup.begin() + issued, reads)) {
+                    dependenceCuts++;
+                    cut = true;
+                    break;
+                }
+                if (active && std::any_of(ahead.begin(), ahead.end(),
+                                          [&](const Simulator::Instruction& producer) {
+                                              return producer.readsMem && reads(producer);
+                                          })) {
+                    loadUseStalls++;
+                    cut = true;
+                    break;
+                }
+                if (memory && memPortUsed) {
+                    memoryPortCuts++;
+                    cut = true;
+                    break;
+                }
+                if (control && branchUsed) {
+                    branchCuts++;
+                    cut = true;
+                    break;
+                }
+                memPortUsed = memPortUsed || memory;
+                branchUsed = branchUsed || control;
+
+                if (active) {
+                    simulator->simOperandCollection(inst);
+                    // later producers in the group ahead are younger, so they win
+                    for (const Simulator::Instruction& producer : ahead) {
+                        if (producer.readsMem || !reads(producer)) continue;
+                        if (inst.readsRs1 && producer.rd == inst.rs1) inst.op1Val = producer.arithResult;
+                        if (inst.readsRs2 && producer.rd == inst.rs2) inst.op2Val = producer.arithResult;
+                    }
+                    simulator->simEX(inst);
+                    uint64_t actualPC = inst.PC + 4;
+                    if (control) {
+                        simulator->simNextPCResolution(inst);
+                        if (predictor) predictor->resolve(inst);
+                        actualPC = inst.nextPC;
+                    }
+                    if (actualPC != inst.predictedPC) {
+                        redirect = true;
+                        redirectPC = actualPC;
+                    }
+                }
+                wide.exGroup.push_back(inst);
+                issued++;
+                // nothing issues with or behind a halt or an ROI marker, so it retires last
+                if (inst.isHalt || inst.roiMarker != ROI_NONE || redirect) break;
+            }
+            wide.idGroup.erase(wide.idGroup.begin(), wide.idGroup.begin() + issued);
+
+            if (redirect || illegalTrap) {
+                wide.idGroup.clear();
+                wide.ifGroup.clear();
+                PC = illegalTrap ? EXCEPTION_HANDLER_ADDR : redirectPC;
+                iMissActive = false;
+                iMissRemaining = 0;
+                if (predictor) predictor->squash();
+            }
+        }
+        issueHistogram[issued]++;
+
+        // ===== ID and IF Stages =====
+        // Fetch restarts the cycle after a redirect
+        if (!dStall && !redirect && !illegalTrap) {
+            if (wide.idGroup.empty() && !wide.ifGroup.empty()) {
+                wide.idGroup.swap(wide.ifGroup);
+                for (Simulator::Instruction& inst : wide.idGroup) {
+                    simulator->simID(inst);
+                    inst.status = NORMAL;
+                    if (predictor && !isControl(inst)) predictor->notControl(inst.PC);
+                }
+            }
+
+            if (wide.ifGroup.empty()) {
+                if (iMissActive) {
+                    if (iMissRemaining == 0) {
+                        fetchGroup();
+                        iMissActive = false;
+                    }
+                } else {
+                    if (iProfile) iProfile->access(PC);
+                    MemoryAccess result = caches->access(I_CACHE, PC, CACHE_READ, PC, cacheClock());
+                    if (result.stall) {
+                        iMissActive = true;
+                        iMissRemaining = static_cast<int64_t>(result.latency);
+                    } else {
+                        fetchGroup();
+                    }
+                }
+            }
+        }
+
+        if (Trace::eventsOnly && traced &&
+            (dStall || iMissActive || cut || redirect || illegalTrap)) {
+            pipeTrace.write(pipeState);
+        }
     }
+
     return status;
 }
 
-Status finalizeSimulator() {
+// Bytes a load or store of funct3 accesses
+static uint64_t accessSize(uint8_t funct3) {
+    return 1ULL << (funct3 & 3);
+}
+
+// The value a load reads out of the data of an older store that covers it
+static uint64_t forwardedValue(const Simulator::Instruction& load,
+                               const Simulator::Instruction& store) {
+    uint64_t size = accessSize(load.funct3);
+    uint64_t value = store.op2Val >> (8 * (load.memAddress - store.memAddress));
+    if (size == DOUBLE_SIZE) return value;
+    value &= (1ULL << (size * 8)) - 1;
+    bool isSigned = load.funct3 == FUNCT3_B || load.funct3 == FUNCT3_H || load.funct3 == FUNCT3_W;
+    return isSigned ? sext64(value, size * 8 - 1) : value;
+}
+
+bool CycleSimulator::operandsReady(const RobEntry& entry, uint64_t now) const {
+    for (uint64_t producer : entry.producers) {
+        if (producer == NO_PRODUCER || producer < ooo.headSeq) continue;
+        const RobEntry& source = ooo.rob[producer - ooo.headSeq];
+        if (!source.issued || source.doneAt > now) return false;
+    }
+    return true;
+}
+
+void CycleSimulator::flushOutOfOrder(uint64_t now) {
+    ooo.fetchQueue.clear();
+    ooo.rob.clear();
+    ooo.headSeq = ooo.nextSeq;
+    std::fill(std::begin(ooo.renameMap), std::end(ooo.renameMap), NO_PRODUCER);
+    ooo.aluQueued = ooo.memQueued = ooo.lsqUsed = 0;
+    ooo.redirectPending = false;
+    ooo.halted = false;
+    ooo.fetchResumeAt = now + 1;
+    PC = EXCEPTION_HANDLER_ADDR;
+    iMissActive = false;
+    iMissRemaining = 0;
+    if (predictor) predictor->squash();
+}
+
+// Out-of-order engine. Fetch works as in the superscalar pipeline and fills a fetch
+// queue; an instruction spends a cycle there being decoded. Dispatch renames up to width
+// instructions a cycle in program order into the ROB, the issue queue and, for loads and
+// stores, the LSQ, and stops at the first one that does not find room in all of them.
+// Values are computed at dispatch, with the operands of the in-flight producers, so the
+// timing model only tracks when each result would be ready:
+//  - issue picks the oldest ready instructions, up to width, one control instruction
+//    and one D-cache access a cycle; ALU and control results take a cycle, loads two
+//    plus the miss latency
+//  - a load takes its data from the youngest older store it overlaps if that store
+//    covers it, and then issues once the store did; a store that only partly covers it
+//    holds dispatch until the store commits. Other loads issue ahead of older stores.
+//  - a wrong next-PC prediction is found at dispatch: the fetch queue is dropped and
+//    fetch restarts on the right path once the control instruction executed, so no
+//    wrong-path instruction gets into the ROB
+//  - commit retires up to width finished instructions through simWB. Stores write the
+//    D-cache and memory at commit. Illegal instructions and memory faults trap there.
+Status CycleSimulator::runOutOfOrderCycles(uint64_t cycles) {
+    uint64_t executed = 0;
+    const uint64_t width = coreConfig.width;
+    const OutOfOrderConfig& window = coreConfig.ooo;
+
+    while (cycles == 0 || executed < cycles) {
+        executed++;
+        cycleCount++;
+        const uint64_t now = cycleCount;
+
+        if (iMissActive && iMissRemaining > 0) iMissRemaining--;
+        if (!mshrs.empty()) {
+            mshrs.erase(std::remove_if(mshrs.begin(), mshrs.end(),
+                                       [&](const Mshr& m) { return m.readyAt < now; }),
+                        mshrs.end());
+            mshrBusyCycles += !mshrs.empty();
+            mshrOccupancy += mshrs.size();
+        }
+        ooo.robOccupancy += ooo.rob.size();
+
+        // ===== Commit =====
+        bool memPortUsed = false;
+        bool trap = false;
+        bool markerCommitted = false;
+        for (uint64_t committed = 0; committed < width && !ooo.rob.empty(); committed++) {
+            RobEntry& head = ooo.rob.front();
+            Simulator::Instruction& inst = head.inst;
+            if (!head.issued || head.doneAt > now) break;
+            if ((!inst.isLegal && !inst.isNop && !inst.isHalt) || inst.memException) {
+                trap = true;
+                break;
+            }
+            if (head.memory && inst.writesMem) {
+                if (memPortUsed || ooo.memoryBusyUntil >= now) break;
+                uint64_t readyAt;
+                if (nonBlocking) {
+                    if (!accessNonBlocking(inst, readyAt)) {
+                        mshrFullStalls++;
+                        break;
+                    }
+                } else {
+                    if (dProfile) dProfile->access(inst.memAddress);
+                    MemoryAccess result =
+                        caches->access(D_CACHE, inst.memAddress, CACHE_WRITE, inst.PC,
+                                       cacheClock());
+                    if (result.stall) ooo.memoryBusyUntil = now + result.latency;
+                }
+                memPortUsed = true;
+                simulator->simMEM(inst);
+                if (inst.memException) {
+                    trap = true;
+                    break;
+                }
+            }
+            simulator->simWB(inst);
+            if (inst.isHalt) return HALT;
+            markerCommitted = markerCommitted || inst.roiMarker != ROI_NONE;
+            if (inst.writesRd && inst.rd != 0 && ooo.renameMap[inst.rd] == head.seq) {
+                ooo.renameMap[inst.rd] = NO_PRODUCER;
+            }
+            ooo.lsqUsed -= head.memory;
+            ooo.rob.pop_front();
+            ooo.headSeq++;
+        }
+        if (trap) {
+            flushOutOfOrder(now);
+            issueHistogram[0]++;
+            continue;
+        }
+
+        // ===== Issue =====
+        uint64_t issued = 0;
+        bool branchUsed = false;
+        for (RobEntry& entry : ooo.rob) {
+            if (issued == width) break;
+            if (entry.issued || entry.dispatchedAt >= now || !operandsReady(entry, now)) continue;
+            bool load = entry.memory && entry.inst.readsMem;
+            bool forwarded = entry.producers[2] != NO_PRODUCER;
+            if (entry.control && branchUsed) continue;
+            if (load && !forwarded) {
+                if (memPortUsed || ooo.memoryBusyUntil >= now) continue;
+                memPortUsed = true;
+                uint64_t readyAt = 0;
+                if (nonBlocking) {
+                    if (!accessNonBlocking(entry.inst, readyAt)) {
+                        mshrFullStalls++;
+                        continue;
+                    }
+                } else {
+                    if (dProfile) dProfile->access(entry.inst.memAddress);
+                    MemoryAccess result =
+                        caches->access(D_CACHE, entry.inst.memAddress, CACHE_READ, entry.inst.PC,
+                                       cacheClock());
+                    if (result.stall) readyAt = ooo.memoryBusyUntil = now + result.latency;
+                }
+                entry.doneAt = std::max(now, readyAt) + 2;
+            } else {
+                entry.doneAt = now + 1;
+            }
+            branchUsed = branchUsed || entry.control;
+            entry.issued = true;
+            issued++;
+            if (window.splitQueues && entry.memory) {
+                ooo.memQueued--;
+            } else {
+                ooo.aluQueued--;
+            }
+            if (ooo.redirectPending && entry.seq == ooo.redirectSeq) {
+                ooo.redirectPending = false;
+                ooo.fetchResumeAt = entry.doneAt;
+            }
+        }
+        issueHistogram[issued]++;
+
+        // ===== Dispatch =====
+        // An ROI marker is serializing: it dispatches into an empty ROB, and nothing
+        // dispatches behind it until the cycle after it committed
+        bool draining = markerCommitted ||
+                        (!ooo.rob.empty() && ooo.rob.back().inst.roiMarker != ROI_NONE);
+        for (uint64_t dispatched = 0; dispatched < width && !ooo.fetchQueue.empty() && !draining;
+             dispatched++) {
+            if (ooo.fetchQueue.front().fetchedAt >= now) break;
+            Simulator::Instruction inst = ooo.fetchQueue.front().inst;
+            if (inst.roiMarker != ROI_NONE && !ooo.rob.empty()) break;
+            bool active = inst.isLegal && !inst.isNop && !inst.isHalt;
+            bool memory = active && (inst.readsMem || inst.writesMem);
+            bool control = active && (inst.opcode == OP_BRANCH || inst.opcode == OP_JAL ||
+                                      inst.opcode == OP_JALR);
+            uint64_t& queued = window.splitQueues && memory ? ooo.memQueued : ooo.aluQueued;
+            if (ooo.rob.size() >= window.robEntries) {
+                ooo.robFullStalls++;
+                break;
+            }
+            if (memory && ooo.lsqUsed >= window.lsqEntries) {
+                ooo.lsqFullStalls++;
+                break;
+            }
+            if (active && queued >= window.iqEntries) {
+                ooo.iqFullStalls++;
+                break;
+            }
+
+            RobEntry entry{inst, ooo.nextSeq, {NO_PRODUCER, NO_PRODUCER, NO_PRODUCER},
+                           now, now, !active, memory, control};
+            uint64_t actualPC = inst.PC + 4;
+            if (active) {
+                Simulator::Instruction& renamed = entry.inst;
+                auto value = [&](uint64_t producer) {
+                    const Simulator::Instruction& source = ooo.rob[producer - ooo.headSeq].inst;
+                    return source.readsMem ? source.memResult : source.arithResult;
+                };
+                simulator->simOperandCollection(renamed);
+                if (renamed.readsRs1 && renamed.rs1 != 0) {
+                    entry.producers[0] = ooo.renameMap[renamed.rs1];
+                    if (entry.producers[0] != NO_PRODUCER) renamed.op1Val = value(entry.producers[0]);
+                }
+                if (renamed.readsRs2 && renamed.rs2 != 0) {
+                    entry.producers[1] = ooo.renameMap[renamed.rs2];
+                    if (entry.producers[1] != NO_PRODUCER) renamed.op2Val = value(entry.producers[1]);
+                }
+                simulator->simEX(renamed);
+
+                if (renamed.readsMem) {
+                    // the youngest older store touching any of its bytes decides
+                    uint64_t size = accessSize(renamed.funct3);
+                    const RobEntry* store = nullptr;
+                    for (auto older = ooo.rob.rbegin(); older != ooo.rob.rend(); ++older) {
+                        const Simulator::Instruction& candidate = older->inst;
+                        if (!older->memory || !candidate.writesMem) continue;
+                        uint64_t storeSize = accessSize(candidate.funct3);
+                        if (candidate.memAddress < renamed.memAddress + size &&
+                            renamed.memAddress < candidate.memAddress + storeSize) {
+                            store = &*older;
+                            break;
+                        }
+                    }
+                    if (store) {
+                        const Simulator::Instruction& data = store->inst;
+                        if (renamed.memAddress < data.memAddress ||
+                            renamed.memAddress + size > data.memAddress + accessSize(data.funct3)) {
+                            ooo.overlapStalls++;
+                            break;
+                        }
+                        renamed.memResult = forwardedValue(renamed, data);
+                        entry.producers[2] = store->seq;
+                        ooo.forwardedLoads++;
+                    } else {
+                        simulator->simMEM(renamed);
+                    }
+                }
+                if (control) {
+                    simulator->simNextPCResolution(renamed);
+                    if (predictor) predictor->resolve(renamed);
+                    actualPC = renamed.nextPC;
+                }
+                if (renamed.writesRd && renamed.rd != 0) ooo.renameMap[renamed.rd] = entry.seq;
+                queued++;
+                ooo.lsqUsed += memory;
+            }
+
+            bool redirect = active && actualPC != inst.predictedPC;
+            ooo.rob.push_back(entry);
+            ooo.nextSeq++;
+            ooo.fetchQueue.pop_front();
+            if (inst.roiMarker != ROI_NONE) break;
+            if (inst.isHalt) {
+                ooo.halted = true;
+                ooo.fetchQueue.clear();
+                iMissActive = false;
+                break;
+            }
+            if (redirect) {
+                ooo.mispredictions++;
+                ooo.fetchQueue.clear();
+                ooo.redirectPending = true;
+                ooo.redirectSeq = entry.seq;
+                PC = actualPC;
+                iMissActive = false;
+                iMissRemaining = 0;
+                if (predictor) predictor->squash();
+                break;
+            }
+        }
+
+        // ===== Fetch =====
+        // The fetch queue holds two groups
+        if (ooo.halted || ooo.redirectPending || now < ooo.fetchResumeAt ||
+            ooo.fetchQueue.size() + width > 2 * width) {
+            continue;
+        }
+        bool arrived = false;
+        if (iMissActive) {
+            arrived = iMissRemaining == 0;
+            if (arrived) iMissActive = false;
+        } else {
+            if (iProfile) iProfile->access(PC);
+            MemoryAccess result = caches->access(I_CACHE, PC, CACHE_READ, PC, cacheClock());
+            if (result.stall) {
+                iMissActive = true;
+                iMissRemaining = static_cast<int64_t>(result.latency);
+            } else {
+                arrived = true;
+            }
+        }
+        if (arrived) {
+            fetchGroup();
+            for (Simulator::Instruction& inst : wide.ifGroup) {
+                simulator->simID(inst);
+                if (predictor && !isControl(inst)) predictor->notControl(inst.PC);
+                ooo.fetchQueue.push_back(FetchedInst{inst, now});
+            }
+            wide.ifGroup.clear();
+        }
+    }
+
+    return SUCCESS;
+}
+
+Status CycleSimulator::runCycles(uint64_t cycles) {
+    if (coreConfig.outOfOrder) return runOutOfOrderCycles(cycles);
+    if (coreConfig.width > 1) {
+        switch (traceConfig.mode) {
+            case TRACE_OFF:
+                return runWideCyclesTraced<TraceOff>(cycles);
+            case TRACE_WINDOW:
+                return runWideCyclesTraced<TraceWindow>(cycles);
+            case TRACE_SAMPLED:
+                return runWideCyclesTraced<TraceSampled>(cycles);
+            case TRACE_EVENTS:
+                return runWideCyclesTraced<TraceEvents>(cycles);
+            default:
+                return runWideCyclesTraced<TraceAll>(cycles);
+        }
+    }
+    switch (traceConfig.mode) {
+        case TRACE_OFF:
+            return runCyclesTraced<TraceOff>(cycles);
+        case TRACE_WINDOW:
+            return runCyclesTraced<TraceWindow>(cycles);
+        case TRACE_SAMPLED:
+            return runCyclesTraced<TraceSampled>(cycles);
+        case TRACE_EVENTS:
+            return runCyclesTraced<TraceEvents>(cycles);
+        default:
+            return runCyclesTraced<TraceAll>(cycles);
+    }
+}
+
+Status CycleSimulator::runTillHalt() {
+    return runCycles(0);
+}
+
+void CycleSimulator::resetPipeline(uint64_t pc) {
+    latches[current] = PipelineInfo{};
+    latches[current].ifInst.PC = pc;
+    wide.ifGroup.clear();
+    wide.idGroup.clear();
+    wide.exGroup.clear();
+    wide.memGroup.clear();
+    wide.wbHead = nop(IDLE);
+    ooo.fetchQueue.clear();
+    ooo.rob.clear();
+    ooo.headSeq = ooo.nextSeq;
+    std::fill(std::begin(ooo.renameMap), std::end(ooo.renameMap), NO_PRODUCER);
+    ooo.aluQueued = ooo.memQueued = ooo.lsqUsed = 0;
+    ooo.redirectPending = false;
+    ooo.halted = false;
+    ooo.fetchResumeAt = ooo.memoryBusyUntil = 0;
+    PC = pc;
+    iMissActive = dMissActive = false;
+    iMissRemaining = dMissRemaining = 0;
+    mshrs.clear();
+    std::fill(std::begin(regReadyAt), std::end(regReadyAt), 0);
+    if (predictor) predictor->squash();
+}
+
+// The I-cache sees one access per block fetch enters, the D-cache the loads and stores
+// and the predictor only the control instructions, the only PCs its BTB can hit
+Status CycleSimulator::fastForward(uint64_t count, RoiMarker until) {
+    const uint64_t blockMask = ~(iCache->config.blockSize - 1);
+    uint64_t fetchBlock = UINT64_MAX;
+    uint64_t dinBefore = simulator->getDin();
+    Status status = SUCCESS;
+    for (uint64_t n = 0; n < count; n++, warmedCycles++) {
+        uint64_t pc = PC;
+        if ((pc & blockMask) != fetchBlock) {
+            fetchBlock = pc & blockMask;
+            if (iProfile) iProfile->access(pc);
+            caches->access(I_CACHE, pc, CACHE_READ, pc, cacheClock());
+        }
+        Simulator::Instruction inst = simulator->simRetire(pc);
+        if (inst.isHalt) {
+            status = HALT;
+            break;
+        }
+        if (!inst.isLegal && !inst.isNop) {
+            PC = EXCEPTION_HANDLER_ADDR;
+            if (predictor) predictor->squash();
+            continue;
+        }
+        if (inst.readsMem || inst.writesMem) {
+            if (dProfile) dProfile->access(inst.memAddress);
+            caches->access(D_CACHE, inst.memAddress,
+                           inst.writesMem ? CACHE_WRITE : CACHE_READ, pc, cacheClock());
+            if (inst.memException) {
+                PC = EXCEPTION_HANDLER_ADDR;
+                if (predictor) predictor->squash();
+                continue;
+            }
+        }
+        PC = inst.nextPC;
+        if (predictor && (inst.opcode == OP_BRANCH || inst.opcode == OP_JAL ||
+                          inst.opcode == OP_JALR)) {
+            inst.predictedPC = predictor->predict(pc);
+            if (predictor->resolve(inst)) predictor->squash();
+        }
+        if (until != ROI_NONE && inst.roiMarker == until) break;
+    }
+    fastForwarded += simulator->getDin() - dinBefore;
+    return status;
+}
+
+Status CycleSimulator::runDetailed(uint64_t count) {
+    uint64_t target = retired() + count;
+    while (retired() < target) {
+        Status status = runCycles(1);
+        if (status != SUCCESS) return status;
+    }
+    return SUCCESS;
+}
+
+// SMARTS (Wunderlich et al.): systematic sampling of short units, each preceded by
+// detailed warming of the pipeline, with the caches and predictor kept warm in between.
+// Each period fast-forwards first, so the program start is not always sampled.
+// A unit the halt cuts short is dropped.
+Status CycleSimulator::runSampled(const SamplingConfig& sampling) {
+    sampled = true;
+    const uint64_t skip = sampling.interval - sampling.warmup - sampling.unit;
+    Status status = SUCCESS;
+    while (status == SUCCESS) {
+        status = fastForward(skip);
+        if (status != SUCCESS) break;
+        resetPipeline(PC);
+        status = runDetailed(sampling.warmup);
+        if (status != SUCCESS) break;
+        uint64_t cycles = cycleCount;
+        uint64_t instructions = retired();
+        status = runDetailed(sampling.unit);
+        if (status != SUCCESS) break;
+        cycles = cycleCount - cycles;
+        instructions = retired() - instructions;
+        measuredCycles += cycles;
+        measuredInstructions += instructions;
+        unitCpi.push_back(static_cast<double>(cycles) / instructions);
+        // whatever is still in flight runs again functionally
+        resetPipeline(resumePC());
+    }
+    if (status == HALT && unitCpi.empty()) {
+        std::cerr << LOG_ERROR << "The program halted before a whole sampling unit ran, "
+                  << "so there is no CPI to extrapolate; use a shorter --sample interval"
+                  << std::endl;
+        return ERROR;
+    }
+    return status;
+}
+
+Status CycleSimulator::runRegion() {
+    Status status = fastForward(UINT64_MAX, ROI_BEGIN);
+    if (status != SUCCESS) {
+        std::cerr << LOG_ERROR << "No ROI-begin marker before the halt" << std::endl;
+        return status;
+    }
+    // the region starts after the marker
+    resetPipeline(PC);
+    startDin = simulator->getDin();
+    fastForwarded = 0;
+    caches->resetStats();
+    if (predictor) predictor->resetStats();
+    if (iProfile) {
+        iProfile->resetStats();
+        dProfile->resetStats();
+    }
+    simulator->clearRetiredMarker();
+    while (simulator->getRetiredMarker() != ROI_END) {
+        status = runCycles(1);
+        if (status != SUCCESS) return status;
+    }
+    if (dumpAllStats() != SUCCESS) return ERROR;
+    statsWritten = true;
+    resetPipeline(resumePC());
+    return fastForward(UINT64_MAX);
+}
+
+double CycleSimulator::sampledCpi() const {
+    double sum = 0.0;
+    for (double cpi : unitCpi) sum += cpi;
+    return unitCpi.empty() ? 0.0 : sum / unitCpi.size();
+}
+
+double CycleSimulator::sampledCpiInterval() const {
+    if (unitCpi.size() < 2) return 0.0;
+    double mean = sampledCpi();
+    double squares = 0.0;
+    for (double cpi : unitCpi) squares += (cpi - mean) * (cpi - mean);
+    double deviation = std::sqrt(squares / (unitCpi.size() - 1));
+    return 1.96 * deviation / std::sqrt(static_cast<double>(unitCpi.size()));
+}
+
+SimulationStats CycleSimulator::getStats() const {
+    // a sampled run reports the cycles extrapolated from its units, or the detailed
+    // cycles it ran if it halted before the first one (runSampled() fails then)
+    uint64_t cycles = cycleCount;
+    if (sampled && !unitCpi.empty()) cycles = std::llround(sampledCpi() * retired());
+    return SimulationStats{retired(),
+                           cycles,
+                           iCache->getHits(),
+                           iCache->getMisses(),
+                           dCache->getHits(),
+                           dCache->getMisses(),
+                           loadUseStalls,
+                           dCache->getWritebacks(),
+                           dCache->getWriteThroughs()};
+}
+
+Status CycleSimulator::finalize() {
+    pipeTrace.close();
     simulator->dumpRegMem(output);
-    SimulationStats stats{simulator->getDin(),
-                          cycleCount,
-                          iCache->getHits(),
-                          iCache->getMisses(),
-                          dCache->getHits(),
-                          dCache->getMisses(),
-                          loadUseStalls};
+    return statsWritten ? SUCCESS : dumpAllStats();
+}
+
+Status CycleSimulator::dumpAllStats() {
+    SimulationStats stats = getStats();
     dumpSimStats(stats, output);
+    caches->dumpStats(output);
+    if (nonBlocking) dumpMshrStats();
+    if (predictor) predictor->dumpStats(output, retired());
+    if (coreConfig.width > 1 || coreConfig.outOfOrder) dumpIssueStats();
+    if (coreConfig.outOfOrder) dumpOutOfOrderStats();
+    if (sampled) dumpSamplingStats();
+    if (iProfile) return dumpMissCurves(*iProfile, *dProfile, output);
     return SUCCESS;
 }
+
+uint64_t CycleSimulator::resumePC() const {
+    if (coreConfig.outOfOrder) {
+        if (!ooo.rob.empty()) return ooo.rob.front().inst.PC;
+        if (!ooo.fetchQueue.empty()) return ooo.fetchQueue.front().inst.PC;
+        return PC;
+    }
+    if (coreConfig.width > 1) {
+        for (const std::vector<Simulator::Instruction>* group :
+             {&wide.memGroup, &wide.exGroup, &wide.idGroup, &wide.ifGroup}) {
+            if (!group->empty()) return group->front().PC;
+        }
+        return PC;
+    }
+    // WB already retired its instruction; a store in MEM wrote memory, but writes the
+    // same bytes again when it runs once more
+    const PipelineInfo& latch = latches[current];
+    for (const Simulator::Instruction* inst :
+         {&latch.memInst, &latch.exInst, &latch.idInst, &latch.ifInst}) {
+        if (isValidInst(*inst)) return inst->PC;
+    }
+    return PC;
+}
+
+// Cycles in the pipeline section count from the cycle the checkpoint was taken in
+static uint64_t relativeCycle(uint64_t cycle, uint64_t now) {
+    return cycle >= now ? cycle - now + 1 : 0;
+}
+
+static uint64_t absoluteCycle(uint64_t relative, uint64_t now) {
+    return relative ? now + relative - 1 : 0;
+}
+
+Status CycleSimulator::saveCheckpoint(const std::string& path, bool caches,
+                                      bool pipeline) const {
+    if (pipeline && (coreConfig.width > 1 || coreConfig.outOfOrder)) {
+        std::cerr << LOG_ERROR << "Only the scalar pipeline can save its latches" << std::endl;
+        return ERROR;
+    }
+    CheckpointSections sections;
+    std::ostringstream arch;
+    putRaw(arch, resumePC());
+    simulator->saveState(arch);
+    sections[SECTION_ARCH] = arch.str();
+
+    if (caches) {
+        std::ostringstream contents;
+        this->caches->saveState(contents);
+        sections[SECTION_CACHES] = contents.str();
+    }
+
+    if (pipeline) {
+        std::ostringstream state;
+        putRaw(state, latches[current]);
+        putRaw(state, PC);
+        putRaw(state, iMissActive);
+        putRaw(state, iMissRemaining);
+        putRaw(state, dMissActive);
+        putRaw(state, dMissRemaining);
+        putRaw(state, static_cast<uint64_t>(mshrs.size()));
+        for (const Mshr& mshr : mshrs) {
+            putRaw(state, mshr.block);
+            putRaw(state, relativeCycle(mshr.readyAt, cycleCount));
+        }
+        for (uint64_t readyAt : regReadyAt) putRaw(state, relativeCycle(readyAt, cycleCount));
+        sections[SECTION_PIPELINE] = state.str();
+    }
+    return writeCheckpoint(path, sections);
+}
+
+Status CycleSimulator::restoreCheckpoint(const std::string& path) {
+    CheckpointSections sections;
+    if (readCheckpoint(path, sections) != SUCCESS) return ERROR;
+    auto arch = sections.find(SECTION_ARCH);
+    if (arch == sections.end()) {
+        std::cerr << LOG_ERROR << "Checkpoint " << path << " has no architectural state"
+                  << std::endl;
+        return ERROR;
+    }
+    std::istringstream archIn(arch->second);
+    if (!getRaw(archIn, PC) || !simulator->restoreState(archIn)) {
+        std::cerr << LOG_ERROR << "Checkpoint " << path << " does not fit this memory"
+                  << std::endl;
+        return ERROR;
+    }
+    startDin = simulator->getDin();
+    resetPipeline(PC);
+
+    auto contents = sections.find(SECTION_CACHES);
+    if (contents != sections.end()) {
+        std::istringstream in(contents->second);
+        if (!caches->restoreState(in)) {
+            std::cerr << LOG_ERROR << "Checkpoint " << path
+                      << " was taken with another cache configuration" << std::endl;
+            return ERROR;
+        }
+    }
+
+    auto pipeline = sections.find(SECTION_PIPELINE);
+    if (pipeline != sections.end()) {
+        if (coreConfig.width > 1 || coreConfig.outOfOrder) {
+            std::cerr << LOG_ERROR << "Checkpoint " << path
+                      << " holds scalar pipeline latches" << std::endl;
+            return ERROR;
+        }
+        std::istringstream in(pipeline->second);
+        uint64_t numMshrs = 0;
+        bool ok = getRaw(in, latches[current]) && getRaw(in, PC) && getRaw(in, iMissActive) &&
+                  getRaw(in, iMissRemaining) && getRaw(in, dMissActive) &&
+                  getRaw(in, dMissRemaining) && getRaw(in, numMshrs);
+        mshrs.clear();
+        for (uint64_t i = 0; ok && i < numMshrs; i++) {
+            Mshr mshr;
+            ok = getRaw(in, mshr.block) && getRaw(in, mshr.readyAt);
+            mshr.readyAt = absoluteCycle(mshr.readyAt, cycleCount);
+            mshrs.push_back(mshr);
+        }
+        for (uint64_t& readyAt : regReadyAt) {
+            ok = ok && getRaw(in, readyAt);
+            readyAt = absoluteCycle(readyAt, cycleCount);
+        }
+        if (!ok) {
+            std::cerr << LOG_ERROR << "Truncated pipeline state in " << path << std::endl;
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+Status CycleSimulator::dumpMshrStats() const {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    // memory-level parallelism: misses in flight, averaged over cycles with any
+    double parallelism =
+        mshrBusyCycles ? static_cast<double>(mshrOccupancy) / mshrBusyCycles : 0.0;
+    simStats << std::left << std::setw(23) << "MSHR misses: "         << mshrMisses << std::endl;
+    simStats << std::left << std::setw(23) << "MSHR merges: "         << mshrMerges << std::endl;
+    simStats << std::left << std::setw(23) << "MSHR-full stalls: "    << mshrFullStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Miss-wait stalls: "    << missWaitStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Memory parallelism: "  << std::fixed
+             << std::setprecision(3) << parallelism << std::endl;
+    return SUCCESS;
+}
+
+Status CycleSimulator::dumpIssueStats() const {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    double ipc = cycleCount ? static_cast<double>(detailedRetired()) / cycleCount : 0.0;
+    simStats << std::left << std::setw(23) << "Issue width: "        << coreConfig.width << std::endl;
+    for (size_t n = 0; n < issueHistogram.size(); n++) {
+        double share = cycleCount ? 100.0 * issueHistogram[n] / cycleCount : 0.0;
+        simStats << std::left << std::setw(23) << "Cycles issuing " + std::to_string(n) + ": "
+                 << issueHistogram[n] << " (" << std::fixed << std::setprecision(1) << share
+                 << "%)" << std::endl;
+    }
+    if (!coreConfig.outOfOrder) {
+        simStats << std::left << std::setw(23) << "Dependence cuts: "    << dependenceCuts << std::endl;
+        simStats << std::left << std::setw(23) << "Memory port cuts: "   << memoryPortCuts << std::endl;
+        simStats << std::left << std::setw(23) << "Branch cuts: "        << branchCuts << std::endl;
+    }
+    simStats << std::left << std::setw(23) << "IPC: "                << std::fixed
+             << std::setprecision(3) << ipc << std::endl;
+    return SUCCESS;
+}
+
+Status CycleSimulator::dumpOutOfOrderStats() const {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    const OutOfOrderConfig& window = coreConfig.ooo;
+    double occupancy = cycleCount ? static_cast<double>(ooo.robOccupancy) / cycleCount : 0.0;
+    uint64_t instructions = retired();
+    double cpi = instructions ? static_cast<double>(cycleCount) / instructions : 0.0;
+    simStats << std::left << std::setw(23) << "ROB entries: "        << window.robEntries << std::endl;
+    simStats << std::left << std::setw(23) << "Issue queue entries: " << window.iqEntries
+             << (window.splitQueues ? " (split)" : " (unified)") << std::endl;
+    simStats << std::left << std::setw(23) << "LSQ entries: "        << window.lsqEntries << std::endl;
+    simStats << std::left << std::setw(23) << "ROB occupancy: "      << std::fixed
+             << std::setprecision(3) << occupancy << std::endl;
+    simStats << std::left << std::setw(23) << "ROB-full stalls: "    << ooo.robFullStalls << std::endl;
+    simStats << std::left << std::setw(23) << "IQ-full stalls: "     << ooo.iqFullStalls << std::endl;
+    simStats << std::left << std::setw(23) << "LSQ-full stalls: "    << ooo.lsqFullStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Overlap stalls: "     << ooo.overlapStalls << std::endl;
+    simStats << std::left << std::setw(23) << "Forwarded loads: "    << ooo.forwardedLoads << std::endl;
+    simStats << std::left << std::setw(23) << "Fetch redirects: "    << ooo.mispredictions << std::endl;
+    simStats << std::left << std::setw(23) << "CPI: "                << cpi << std::endl;
+    return SUCCESS;
+}
+
+Status CycleSimulator::dumpSamplingStats() const {
+    std::ofstream simStats(output + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+    double cpi = sampledCpi();
+    double interval = sampledCpiInterval();
+    double relative = cpi > 0.0 ? 100.0 * interval / cpi : 0.0;
+    simStats << std::left << std::setw(23) << "Sampled units: "      << unitCpi.size() << std::endl;
+    simStats << std::left << std::setw(23) << "Measured instructions: " << measuredInstructions
+             << std::endl;
+    simStats << std::left << std::setw(23) << "Measured cycles: "    << measuredCycles << std::endl;
+    simStats << std::left << std::setw(23) << "Detailed cycles: "    << cycleCount << std::endl;
+    simStats << std::left << std::setw(23) << "Fast-forwarded: "     << fastForwarded << std::endl;
+    // no unit, no estimate
+    if (unitCpi.empty()) return SUCCESS;
+    simStats << std::left << std::setw(23) << "Sampled CPI: "        << std::fixed
+             << std::setprecision(4) << cpi << std::endl;
+    simStats << std::left << std::setw(23) << "CPI 95% interval: "   << "+/- " << interval
+             << " (" << std::setprecision(2) << relative << "%)" << std::endl;
+    return SUCCESS;
+}
+
+std::string checkSamplingConfig(const SamplingConfig& sampling) {
+    if (sampling.region && sampling.interval) return "--roi and --sample do not go together";
+    if (sampling.interval == 0) return "";
+    if (sampling.unit == 0) return "the sampling unit needs at least one instruction";
+    if (sampling.interval < sampling.warmup + sampling.unit) {
+        return "the sampling interval must be at least warmup + unit instructions";
+    }
+    return "";
+}
+
+std::string checkCoreConfig(const CoreConfig& core, const CacheConfig& dcConfig) {
+    if (core.width != 1 && core.width != 2 && core.width != 4) return "width must be 1, 2 or 4";
+    if (core.width > 1 && dcConfig.mshrs > 0 && !core.outOfOrder) {
+        return "the superscalar pipeline needs a blocking D-cache (dcache.mshrs 0)";
+    }
+    if (core.outOfOrder &&
+        (core.ooo.robEntries == 0 || core.ooo.iqEntries == 0 || core.ooo.lsqEntries == 0)) {
+        return "ROB, issue queue and LSQ need at least one entry";
+    }
+    return checkPredictorConfig(core.predictor);
+}
+
+Status initSimulator(CacheConfig& iCacheConfig, CacheConfig& dCacheConfig, MemoryStore* mem,
+                     const std::string& output_name, const TraceConfig& trace,
+                     const CoreConfig& core, const HierarchyConfig& hierarchy) {
+    delete defaultSimulator;
+    defaultSimulator = new CycleSimulator(iCacheConfig, dCacheConfig, mem, output_name, trace,
+                                          core, hierarchy);
+    return SUCCESS;
+}
+
+Status runCycles(uint64_t cycles) {
+    return defaultSimulator->runCycles(cycles);
+}
+
+Status runTillHalt() {
+    return defaultSimulator->runTillHalt();
+}
+
+Status runSampled(const SamplingConfig& sampling) {
+    return defaultSimulator->runSampled(sampling);
+}
+
+Status runRegion() {
+    return defaultSimulator->runRegion();
+}
+
+Status saveCheckpoint(const std::string& path, bool caches, bool pipeline) {
+    return defaultSimulator->saveCheckpoint(path, caches, pipeline);
+}
+
+Status restoreCheckpoint(const std::string& path) {
+    return defaultSimulator->restoreCheckpoint(path);
+}
+
+Status finalizeSimulator() {
+    return defaultSimulator->finalize();
+}
@@ -1,20 +1,296 @@
 #pragma once
+#include <deque>
 #include <string>
+#include <vector>
 
+#include "bpred.h"
 #include "cache.h"
+#include "checkpoint.h"
+#include "hierarchy.h"
 #include "Utilities.h"
 #include "simulator.h"
+#include "stackdist.h"
+
+// Window sizes of the out-of-order engine
+struct OutOfOrderConfig {
+    uint64_t robEntries = 64;
+    uint64_t iqEntries = 32;    // per queue when the queues are split
+    bool splitQueues = false;   // one queue for ALU and control instructions, one for memory
+    uint64_t lsqEntries = 16;   // loads and stores from dispatch to commit
+};
+
+// Options of the pipeline model and of the analyses run alongside it
+struct CoreConfig {
+    // jump over cycles in which a D-cache miss, or an I-cache miss with nothing behind
+    // IF, keeps the whole pipeline frozen (scalar pipeline only)
+    bool skipStalls = true;
+    // profile stack distances of both cache streams into <base>_miss_curve.csv
+    bool missCurves = false;
+    // sort the misses of both L1s into compulsory, capacity and conflict misses
+    bool classifyMisses = false;
+    // next-PC prediction in IF; PREDICT_NONE falls through and redirects taken branches in ID
+    PredictorConfig predictor;
+    // instructions fetched and issued per cycle: 1 runs the scalar pipeline, 2 or 4 the
+    // in-order superscalar one
+    uint64_t width = 1;
+    // run the out-of-order engine instead, width wide in every stage; it writes no pipe trace
+    bool outOfOrder = false;
+    OutOfOrderConfig ooo;
+};
+
+// @return an error message, or "" if core is usable with a D-cache of dcConfig
+std::string checkCoreConfig(const CoreConfig& core, const CacheConfig& dcConfig);
+
+// Sampled simulation: every interval instructions, warmup instructions run in detail to
+// fill the pipeline and then unit more are measured. The rest is fast-forwarded.
+struct SamplingConfig {
+    uint64_t interval = 0;  // 0 simulates every cycle
+    uint64_t warmup = 2000;
+    uint64_t unit = 1000;
+    // Instead, simulate in detail only between the ROI-begin and ROI-end markers
+    bool region = false;
+};
+
+// @return an error message, or "" if sampling is usable
+std::string checkSamplingConfig(const SamplingConfig& sampling);
+
+Simulator::Instruction nop(StageStatus status);
+
+struct PipelineInfo {
+    Simulator::Instruction ifInst = nop(IDLE);
+    Simulator::Instruction idInst = nop(IDLE);
+    Simulator::Instruction exInst = nop(IDLE);
+    Simulator::Instruction memInst = nop(IDLE);
+    Simulator::Instruction wbInst = nop(IDLE);
+};
+
+// One cycle-accurate simulation. It owns all of its state (simulator, caches, pipe
+// trace, latches and counters), so independent instances can run side by side, e.g.
+// one per thread of a parameter sweep.
+class CycleSimulator {
+   private:
+    Simulator* simulator;
+    Cache* iCache;
+    Cache* dCache;
+    CacheHierarchy* caches;
+    StackDistanceProfiler* iProfile = nullptr;
+    StackDistanceProfiler* dProfile = nullptr;
+    BranchPredictor* predictor = nullptr;
+    std::string output;
+    PipeStateWriter pipeTrace;
+    TraceConfig traceConfig;
+    CoreConfig coreConfig;
+    bool nonBlocking;
+
+    uint64_t cycleCount = 0;
+    uint64_t loadUseStalls = 0;
+    uint64_t PC = 0;
+    // din when the run started, so a run restored from a checkpoint counts from there
+    uint64_t startDin = 0;
+
+    // Sampled runs: instructions executed functionally, the cycles and instructions of
+    // the measured units and the CPI of each one
+    bool sampled = false;
+    uint64_t fastForwarded = 0;
+    uint64_t warmedCycles = 0;  // a cycle per fast-forwarded instruction, see cacheClock()
+    uint64_t measuredCycles = 0;
+    uint64_t measuredInstructions = 0;
+    std::vector<double> unitCpi;
+    // a region-of-interest run wrote the stats when its region ended
+    bool statsWritten = false;
+
+    // Cache miss tracking
+    bool iMissActive = false;
+    int64_t iMissRemaining = 0;
+    bool dMissActive = false;
+    int64_t dMissRemaining = 0;
+
+    // Non-blocking D-cache (dcache.mshrs > 0): misses in flight, one per block, and the
+    // last cycle in which each register a missing load writes is still pending
+    struct Mshr {
+        uint64_t block;
+        uint64_t readyAt;
+    };
+    std::vector<Mshr> mshrs;
+    uint64_t regReadyAt[NUM_REGS] = {};
+    uint64_t mshrMisses = 0;       // misses that took an MSHR
+    uint64_t mshrMerges = 0;       // accesses to a block already in flight
+    uint64_t mshrFullStalls = 0;   // cycles a miss waited for a free MSHR
+    uint64_t missWaitStalls = 0;   // cycles ID waited for a register a miss writes
+    uint64_t mshrBusyCycles = 0;   // cycles with at least one miss in flight
+    uint64_t mshrOccupancy = 0;    // sum of misses in flight over those cycles
+
+    // Double-buffered pipeline latches: each cycle reads latches[current] and writes
+    // every stage of latches[current ^ 1] in place, then flips current
+    PipelineInfo latches[2];
+    int current = 0;
+
+    // Superscalar mode (width > 1): each stage holds a group of instructions in program
+    // order. Stages run from WB back to IF, each one taking over the group of the stage
+    // before it, so no second copy is needed. wbHead is the oldest instruction that
+    // retired last cycle, for the pipe trace.
+    struct WideLatches {
+        std::vector<Simulator::Instruction> ifGroup;
+        std::vector<Simulator::Instruction> idGroup;
+        std::vector<Simulator::Instruction> exGroup;
+        std::vector<Simulator::Instruction> memGroup;
+        Simulator::Instruction wbHead = nop(IDLE);
+    };
+    WideLatches wide;
+    std::vector<uint64_t> issueHistogram;  // [n]: cycles that issued n instructions
+    uint64_t dependenceCuts = 0;           // issue stopped at an operand of the same group
+    uint64_t memoryPortCuts = 0;           // ... at a second load or store
+    uint64_t branchCuts = 0;               // ... at a second control instruction
+
+    // Out-of-order engine. Instructions are numbered in dispatch order; producer fields
+    // hold the number of an older instruction, or NO_PRODUCER.
+    static const uint64_t NO_PRODUCER = UINT64_MAX;
+    struct RobEntry {
+        Simulator::Instruction inst;
+        uint64_t seq;
+        uint64_t producers[3];  // writers of rs1 and rs2, and the store a load forwards from
+        uint64_t dispatchedAt;
+        uint64_t doneAt;        // first cycle its result can be used, once issued
+        bool issued;
+        bool memory;
+        bool control;
+    };
+    struct FetchedInst {
+        Simulator::Instruction inst;
+        uint64_t fetchedAt;
+    };
+    struct OutOfOrderState {
+        std::deque<FetchedInst> fetchQueue;  // decoded, waiting for dispatch
+        std::deque<RobEntry> rob;            // program order, rob[i].seq == headSeq + i
+        uint64_t headSeq = 0;
+        uint64_t nextSeq = 0;
+        uint64_t renameMap[NUM_REGS];        // youngest in-flight writer of each register
+        uint64_t aluQueued = 0;              // dispatched and not issued, per queue; a
+        uint64_t memQueued = 0;              // unified queue only counts aluQueued
+        uint64_t lsqUsed = 0;
+        bool redirectPending = false;        // fetch waits for redirectSeq to execute
+        uint64_t redirectSeq = 0;
+        uint64_t fetchResumeAt = 0;
+        bool halted = false;                 // the halt dispatched, nothing is fetched after it
+        uint64_t memoryBusyUntil = 0;        // blocking D-cache: last cycle of the miss in flight
+
+        uint64_t robOccupancy = 0;           // sum of ROB entries over all cycles
+        uint64_t robFullStalls = 0;          // cycles dispatch stopped at a full ROB
+        uint64_t iqFullStalls = 0;           // ... at a full issue queue
+        uint64_t lsqFullStalls = 0;          // ... at a full LSQ
+        uint64_t overlapStalls = 0;          // ... at a load only partly covered by a store
+        uint64_t forwardedLoads = 0;         // loads that took their data from an older store
+        uint64_t mispredictions = 0;         // fetch redirects
+    };
+    OutOfOrderState ooo;
+
+    uint64_t frozenCycles(const PipelineInfo& old) const;
+    // Start the D-cache access of inst in MEM without blocking on a miss
+    // @return false if it misses while every MSHR is busy, so inst has to retry
+    // @param readyAt set to the last cycle of the miss inst waits for, 0 if it hits
+    bool accessNonBlocking(const Simulator::Instruction& inst, uint64_t& readyAt);
+    // append the MSHR counters to <output>_sim_stats.out
+    Status dumpMshrStats() const;
+    template <typename Trace>
+    Status runCyclesTraced(uint64_t cycles);
+    // Fetch the group starting at PC, up to width instructions in its I-cache block
+    void fetchGroup();
+    template <typename Trace>
+    Status runWideCyclesTraced(uint64_t cycles);
+    // append the issue histogram to <output>_sim_stats.out
+    Status dumpIssueStats() const;
+    // Whether every producer of entry has its result by cycle now
+    bool operandsReady(const RobEntry& entry, uint64_t now) const;
+    // Squash everything in flight and restart fetch at the exception handler
+    void flushOutOfOrder(uint64_t now);
+    Status runOutOfOrderCycles(uint64_t cycles);
+    // append the window occupancy and dispatch stalls to <output>_sim_stats.out
+    Status dumpOutOfOrderStats() const;
+    // instructions retired since the run started
+    uint64_t retired() const { return simulator->getDin() - startDin; }
+    // ... and of them, those the timing model ran
+    uint64_t detailedRetired() const { return retired() - fastForwarded; }
+    // The time the cache hierarchy sees. It keeps running while fast-forwarding, so
+    // prefetches started then are done by the time the timing model takes over.
+    uint64_t cacheClock() const { return cycleCount + warmedCycles; }
+    // Empty every pipeline and restart fetch at pc, dropping the misses in flight
+    void resetPipeline(uint64_t pc);
+    /** Execute up to count instructions functionally from PC, keeping the caches, miss
+     * profiles and predictor warm. Traps go to the exception handler as in the pipeline.
+     * @param until stop early once a marker of this kind retired
+     * @return HALT once the halt instruction retired, SUCCESS otherwise
+     */
+    Status fastForward(uint64_t count, RoiMarker until = ROI_NONE);
+    // Run the timing model until count more instructions retired
+    Status runDetailed(uint64_t count);
+    // Mean CPI of the measured units, and the half-width of its 95% confidence interval
+    double sampledCpi() const;
+    double sampledCpiInterval() const;
+    // append the sampling estimate to <output>_sim_stats.out
+    Status dumpSamplingStats() const;
+    // write <output>_sim_stats.out and the miss curves
+    Status dumpAllStats();
+    // PC of the oldest instruction that has not retired yet
+    uint64_t resumePC() const;
+
+   public:
+    // Takes ownership of memory
+    CycleSimulator(CacheConfig& icConfig, CacheConfig& dcConfig, MemoryStore* memory,
+                   const std::string& output_name, const TraceConfig& trace = TraceConfig{},
+                   const CoreConfig& core = CoreConfig{},
+                   const HierarchyConfig& hierarchy = HierarchyConfig{});
+    ~CycleSimulator();
+    CycleSimulator(const CycleSimulator&) = delete;
+    CycleSimulator& operator=(const CycleSimulator&) = delete;
+
+    Status runCycles(uint64_t cycles);
+    Status runTillHalt();
+    // Run till halt, alternating fast-forward with detailed units; total cycles are then
+    // extrapolated from the CPI the units measured
+    Status runSampled(const SamplingConfig& sampling);
+    /** Run till halt, fast-forwarding up to the ROI-begin marker and simulating in detail
+     * from there with warm caches and predictor. Counters start at ROI-begin and the
+     * stats are written when ROI-end retires; the rest runs functionally.
+     */
+    Status runRegion();
+    SimulationStats getStats() const;
+
+    /** Save the architectural state to a checkpoint at path. Execution resumes from it
+     * at the oldest instruction still in flight, unless pipeline is set: then the
+     * latches of the scalar pipeline are saved too and it resumes exactly here.
+     * @param caches also save the contents of every cache
+     */
+    Status saveCheckpoint(const std::string& path, bool caches, bool pipeline) const;
+    // Start from the checkpoint at path, before the first cycle; counters start at 0
+    Status restoreCheckpoint(const std::string& path);
+    // close the pipe trace and dump registers, memory and stats
+    Status finalize();
+};
+
+// The functions below drive one process-wide CycleSimulator
 
 // init the simulator and all info
 Status initSimulator(CacheConfig& icConfig, CacheConfig& dcConfig, MemoryStore* memory,
-                     const std::string& output_name);
+                     const std::string& output_name, const TraceConfig& trace = TraceConfig{},
+                     const CoreConfig& core = CoreConfig{},
+                     const HierarchyConfig& hierarchy = HierarchyConfig{});
 
 // run the simulator for a certain number of cycles
 Status runCycles(uint64_t cycles);
 
-// run till halt (call runCycles() with cycles == 1 each time) until
-// status tells you to HALT or ERROR out
+// run till halt (one unbounded runCycles() call, so frozen cycles can be skipped
+// in bulk) until status tells you to HALT or ERROR out
 Status runTillHalt();
 
+// run till halt in sampled mode, see CycleSimulator::runSampled()
+Status runSampled(const SamplingConfig& sampling);
+
+// run till halt with only the region of interest in detail, see CycleSimulator::runRegion()
+Status runRegion();
+
+// save or restore a checkpoint, see CycleSimulator
+Status saveCheckpoint(const std::string& path, bool caches, bool pipeline);
+Status restoreCheckpoint(const std::string& path);
+
 // dump the state of the simulator
 Status finalizeSimulator();
\ No newline at end of file
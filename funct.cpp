@@ -1,30 +1,94 @@
 #include "funct.h"
 
 #include <iostream>
+#include <sstream>
 
+#include "block.h"
 #include "cache.h"
+#include "checkpoint.h"
 #include "Utilities.h"
 #include "simulator.h"
 
-static Simulator* simulator = nullptr;
-static std::string output;
-static uint64_t PC = 0;
+// Simulation behind the initSimulator()/runInstructions()/finalizeSimulator() API
+static FunctSimulator* defaultSimulator = nullptr;
 
 // initialize the simulator
-Status initSimulator(MemoryStore* mem, const std::string& output_name) {
-    output = output_name;
+FunctSimulator::FunctSimulator(MemoryStore* mem, const std::string& output_name,
+                               FunctEngine engine)
+    : output(output_name) {
     simulator = new Simulator();
     simulator->setMemory(mem);
+    if (engine != ENGINE_INTERP) blockEngine = new BlockEngine(simulator);
+    if (engine == ENGINE_NATIVE || engine == ENGINE_CHECK) {
+        if (!blockEngine->enableNative()) {
+            std::cerr << LOG_ERROR << "No native backend on this host, using the block engine"
+                      << std::endl;
+        }
+    }
+    if (engine == ENGINE_CHECK) {
+        reference = new Simulator();
+        reference->setMemory(new MemoryStore(*mem));
+        blockEngine->setStepBlocks(true);
+    }
+}
+
+FunctSimulator::~FunctSimulator() {
+    delete blockEngine;
+    delete simulator;
+    delete reference;
+}
+
+// true if the engine and the reference interpreter agree on PC, registers and memory
+bool FunctSimulator::sameArchState() {
+    if (PC != referencePC || simulator->getDin() != reference->getDin()) return false;
+    for (uint64_t reg = 1; reg < 32; reg++) {
+        if (simulator->getReg(reg) != reference->getReg(reg)) return false;
+    }
+    return simulator->getMemory()->sameContents(*reference->getMemory());
+}
+
+// Run the block engine one block at a time, stepping the interpreter over the same
+// number of instructions after each block and comparing the architectural state
+Status FunctSimulator::runChecked(uint64_t instructions) {
+    uint64_t numInstructions = 0;
+    while (instructions == 0 || numInstructions < instructions) {
+        uint64_t blockStart = PC;
+        uint64_t executed;
+        Status status = blockEngine->run(PC, instructions ? instructions - numInstructions : 0,
+                                         executed);
+        numInstructions += executed;
+
+        Status referenceStatus = SUCCESS;
+        for (uint64_t i = 0; i < executed; i++) {
+            Simulator::Instruction inst = reference->simInstruction(referencePC);
+            referencePC = inst.nextPC;
+            if (inst.isHalt) referenceStatus = HALT;
+            else if (!inst.isLegal) referenceStatus = ERROR;
+        }
+
+        if (status != referenceStatus || !sameArchState()) {
+            std::cerr << LOG_ERROR << "Engine check failed in the block at 0x" << std::hex
+                      << blockStart << std::dec << " after " << simulator->getDin()
+                      << " instructions" << std::endl;
+            return ERROR;
+        }
+        if (status != SUCCESS) return status;
+    }
     return SUCCESS;
 }
 
 // run the simulator for a certain number of intructions
 // return SUCCESS if count of executed instructions == desired intructions.
 // return HALT if the simulator halts on 0xfeedfeed
-Status runInstructions(uint64_t instructions) {
+Status FunctSimulator::runInstructions(uint64_t instructions) {
     uint64_t numInstructions = 0;
     auto status = SUCCESS;
 
+    if (reference) return runChecked(instructions);
+    if (blockEngine) {
+        return blockEngine->run(PC, instructions, numInstructions);
+    }
+
     while (instructions == 0 || numInstructions < instructions) {
 
         Simulator::Instruction inst = simulator->simInstruction(PC);
@@ -45,21 +109,78 @@ Status runInstructions(uint64_t instructions) {
     return status;
 }
 
-// run till halt (call runInstructions() with instructions == 1 each time) until
-// status tells you to HALT or ERROR out
-Status runTillHalt() {
+// run till halt (call runInstructions() until status tells you to HALT or ERROR out)
+// The block engine runs unbounded so that it can stay inside chained blocks.
+Status FunctSimulator::runTillHalt() {
     Status status;
     while (true) {
-        status = static_cast<Status>(runInstructions(1));
+        status = static_cast<Status>(runInstructions(blockEngine ? 0 : 1));
         if (status == HALT || status == ERROR) break;
     }
     return status;
 }
 
+Status FunctSimulator::saveCheckpoint(const std::string& path) const {
+    std::ostringstream arch;
+    putRaw(arch, PC);
+    simulator->saveState(arch);
+    return writeCheckpoint(path, CheckpointSections{{SECTION_ARCH, arch.str()}});
+}
+
+Status FunctSimulator::restoreCheckpoint(const std::string& path) {
+    CheckpointSections sections;
+    if (readCheckpoint(path, sections) != SUCCESS) return ERROR;
+    auto arch = sections.find(SECTION_ARCH);
+    if (arch == sections.end()) {
+        std::cerr << LOG_ERROR << "Checkpoint " << path << " has no architectural state"
+                  << std::endl;
+        return ERROR;
+    }
+    std::istringstream in(arch->second);
+    if (!getRaw(in, PC) || !simulator->restoreState(in)) {
+        std::cerr << LOG_ERROR << "Checkpoint " << path << " does not fit this memory"
+                  << std::endl;
+        return ERROR;
+    }
+    if (reference) {
+        std::istringstream again(arch->second);
+        getRaw(again, referencePC);
+        reference->restoreState(again);
+    }
+    startDin = simulator->getDin();
+    return SUCCESS;
+}
+
 // dump the stats of the simulator
-Status finalizeSimulator() {
+Status FunctSimulator::finalize() {
     simulator->dumpRegMem(output);
-    SimulationStats stats{simulator->getDin(), 0,};
+    SimulationStats stats{simulator->getDin() - startDin, 0,};
     dumpSimStats(stats, output);
     return SUCCESS;
 }
+
+Status initSimulator(MemoryStore* mem, const std::string& output_name, FunctEngine engine) {
+    delete defaultSimulator;
+    defaultSimulator = new FunctSimulator(mem, output_name, engine);
+    return SUCCESS;
+}
+
+Status runInstructions(uint64_t instructions) {
+    return defaultSimulator->runInstructions(instructions);
+}
+
+Status runTillHalt() {
+    return defaultSimulator->runTillHalt();
+}
+
+Status saveCheckpoint(const std::string& path) {
+    return defaultSimulator->saveCheckpoint(path);
+}
+
+Status restoreCheckpoint(const std::string& path) {
+    return defaultSimulator->restoreCheckpoint(path);
+}
+
+Status finalizeSimulator() {
+    return defaultSimulator->finalize();
+}
@@ -4,15 +4,68 @@
 #include "Utilities.h"
 #include "simulator.h"
 
+// Execution engine used by runInstructions()
+enum FunctEngine {
+    ENGINE_INTERP = 0,  // Simulator::simInstruction() one instruction at a time
+    ENGINE_BLOCK,       // translated, chained basic blocks (BlockEngine)
+    ENGINE_NATIVE,      // BlockEngine with hot blocks compiled to x86-64 (NativeBackend)
+    ENGINE_CHECK,       // ENGINE_NATIVE checked against the interpreter after every block
+};
+
+class BlockEngine;
+
+// One functional simulation with all of its state, so independent instances can run
+// side by side (e.g. one per thread)
+class FunctSimulator {
+   private:
+    Simulator* simulator;
+    BlockEngine* blockEngine = nullptr;
+    std::string output;
+    uint64_t PC = 0;
+    // din when the run started, so a run restored from a checkpoint counts from there
+    uint64_t startDin = 0;
+
+    // ENGINE_CHECK: interpreter run in lock-step on its own copy of memory
+    Simulator* reference = nullptr;
+    uint64_t referencePC = 0;
+
+    bool sameArchState();
+    Status runChecked(uint64_t instructions);
+
+   public:
+    // Takes ownership of memory
+    FunctSimulator(MemoryStore* memory, const std::string& output_name,
+                   FunctEngine engine = ENGINE_BLOCK);
+    ~FunctSimulator();
+    FunctSimulator(const FunctSimulator&) = delete;
+    FunctSimulator& operator=(const FunctSimulator&) = delete;
+
+    Status runInstructions(uint64_t instructions);
+    Status runTillHalt();
+    // Save PC, din, registers and memory to a checkpoint at path
+    Status saveCheckpoint(const std::string& path) const;
+    // Start from the checkpoint at path, before the first instruction; sections other
+    // than the architectural state are skipped
+    Status restoreCheckpoint(const std::string& path);
+    // dump registers, memory and stats
+    Status finalize();
+};
+
+// The functions below drive one process-wide FunctSimulator
+
 // init the simulator and all info
-Status initSimulator(MemoryStore* memory, const std::string& output_name);
+Status initSimulator(MemoryStore* memory, const std::string& output_name,
+                     FunctEngine engine = ENGINE_BLOCK);
 
 // run the simulator for a certain number of instructions
 Status runInstructions(uint64_t instructions);
 
-// run till halt (call runInstructions() with instructions == 1 each time) until
-// status tells you to HALT or ERROR out
+// run till halt (call runInstructions() until status tells you to HALT or ERROR out)
 Status runTillHalt();
 
+// save or restore a checkpoint, see FunctSimulator
+Status saveCheckpoint(const std::string& path);
+Status restoreCheckpoint(const std::string& path);
+
 // dump the state of the simulator
 Status finalizeSimulator();
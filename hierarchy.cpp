@@ -0,0 +1,369 @@
+#include "hierarchy.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "MemoryStore.h"
+#include "checkpoint.h"
+
+CacheHierarchy::CacheHierarchy(Cache* iCache, Cache* dCache, const HierarchyConfig& config)
+    : l1{iCache, dCache}, memoryLatency(config.memoryLatency) {
+    for (const CacheConfig& level : config.levels) levels.push_back(new Cache(level, D_CACHE));
+    missCycles[I_CACHE].assign(levels.size() + 3, 0);
+    missCycles[D_CACHE].assign(levels.size() + 3, 0);
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        const CacheConfig& l1Config = l1[side]->config;
+        prefetch[side].prefetcher =
+            makePrefetcher(l1Config.prefetcher, l1Config.blockSize, l1Config.prefetchDegree,
+                           l1Config.prefetchDistance);
+        if (l1Config.victimEntries > 0) {
+            CacheConfig victimConfig{l1Config.victimEntries * l1Config.blockSize,
+                                     l1Config.blockSize, l1Config.victimEntries, 0};
+            victims[side] = new Cache(victimConfig, static_cast<CacheDataType>(side));
+        }
+    }
+}
+
+CacheHierarchy::~CacheHierarchy() {
+    for (Cache* level : levels) delete level;
+    delete prefetch[I_CACHE].prefetcher;
+    delete prefetch[D_CACHE].prefetcher;
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        delete victims[side];
+        delete classifier[side];
+    }
+}
+
+void CacheHierarchy::classifyMisses() {
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        if (classifier[side]) continue;
+        classifier[side] = new MissClassifier(l1[side]->config.cacheSize, l1[side]->config.blockSize);
+    }
+}
+
+void CacheHierarchy::saveState(std::ostream& out) const {
+    putRaw(out, static_cast<uint64_t>(levels.size()));
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        l1[side]->saveState(out);
+        putRaw(out, victims[side] != nullptr);
+        if (victims[side]) victims[side]->saveState(out);
+    }
+    for (const Cache* level : levels) level->saveState(out);
+}
+
+bool CacheHierarchy::restoreState(std::istream& in) {
+    uint64_t numSaved;
+    if (!getRaw(in, numSaved) || numSaved != levels.size()) return false;
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        bool hasVictims;
+        if (!l1[side]->restoreState(in) || !getRaw(in, hasVictims) ||
+            hasVictims != (victims[side] != nullptr)) {
+            return false;
+        }
+        if (victims[side] && !victims[side]->restoreState(in)) return false;
+    }
+    for (Cache* level : levels) {
+        if (!level->restoreState(in)) return false;
+    }
+    return true;
+}
+
+MemoryAccess CacheHierarchy::access(CacheDataType side, uint64_t address,
+                                    CacheOperation readWrite, uint64_t pc, uint64_t now) {
+    Cache& first = *l1[side];
+    CacheAccess result = first.access(address, readWrite);
+    MemoryAccess access{result.hit, !result.hit && result.allocated, 0};
+
+    if (classifier[side]) classifier[side]->access(address, !result.hit);
+
+    // whether the fill comes up the miss path from below the L1
+    bool pathFill = false;
+    if (access.stall) {
+        Cache* victim = victims[side];
+        pathFill = !(victim && victim->lookup(address).hit);
+        if (!pathFill) {
+            // swap: the block comes back and the L1 victim takes its place below
+            if (victim->invalidate(address)) first.fill(address, true);
+            access.latency = first.config.victimLatency;
+            charge(side, levels.size() + 2, first.config.victimLatency);
+        } else if (levels.empty()) {
+            access.latency = first.config.missLatency;
+            charge(side, levels.size() + 1, first.config.missLatency);
+        } else {
+            bool dirtyLine = false;
+            access.latency = fetch(1, address, side, dirtyLine);
+            if (dirtyLine) first.fill(address, true);
+        }
+        // the dirty victim is written back before the fill
+        uint64_t writeback = evictL1(result, side);
+        charge(side, 0, writeback);
+        access.latency += writeback;
+    }
+
+    if (!levels.empty()) {
+        // Stores a write-through or write-around L1 does not keep go on to the first
+        // level below that may hold the block
+        if (readWrite == CACHE_WRITE && (!first.config.writeBack || !result.allocated)) {
+            size_t position = 1;
+            while (exclusive(position) && !levels[position - 1]->probe(address)) position++;
+            writeDown(position, address, true, side);
+        }
+    }
+
+    PrefetchState& state = prefetch[side];
+    if (!state.prefetcher) return access;
+
+    uint64_t block = address & ~(first.config.blockSize - 1);
+    if (result.evicted) state.unused.erase(result.victimAddress);
+    bool prefetchHit = false;
+    auto prefetched = state.unused.find(block);
+    if (prefetched != state.unused.end()) {
+        // a miss means the prefetched block was invalidated before it was used
+        if (result.hit) {
+            prefetchHit = true;
+            if (prefetched->second > now) {
+                state.late++;
+                access.stall = true;
+                access.latency = prefetched->second - now;
+            } else {
+                state.useful++;
+            }
+        }
+        state.unused.erase(prefetched);
+    }
+    if (!result.hit && state.displaced.erase(block)) state.polluting++;
+    // the demand miss queues behind the prefetches on the miss path and holds it for its
+    // own fill, so the prefetches it triggers go after it
+    if (pathFill) {
+        if (state.pathFreeAt > now) access.latency += state.pathFreeAt - now;
+        state.pathFreeAt = now + access.latency;
+    }
+
+    state.candidates.clear();
+    state.prefetcher->observe(pc, address, !result.hit, prefetchHit, state.candidates);
+    for (uint64_t candidate : state.candidates) {
+        uint64_t target = candidate & ~(first.config.blockSize - 1);
+        if (target >= MEMORY_SIZE || first.probe(target)) continue;
+        uint64_t start = std::max(now, state.pathFreeAt);
+        state.pathFreeAt = start + prefetchFill(side, target);
+        state.unused[target] = state.pathFreeAt;
+        state.displaced.erase(target);
+        state.issued++;
+    }
+    return access;
+}
+
+uint64_t CacheHierarchy::prefetchFill(CacheDataType side, uint64_t block) {
+    Cache& first = *l1[side];
+    CacheAccess fill = first.fill(block, false);
+    if (fill.evicted) {
+        prefetch[side].unused.erase(fill.victimAddress);
+        prefetch[side].displaced.insert(fill.victimAddress);
+    }
+    prefetching = true;
+    uint64_t latency = first.config.missLatency;
+    if (!levels.empty()) {
+        bool dirtyLine = false;
+        latency = fetch(1, block, side, dirtyLine);
+        if (dirtyLine) first.fill(block, true);
+    }
+    latency += evictL1(fill, side);
+    prefetching = false;
+    return latency;
+}
+
+uint64_t CacheHierarchy::fetch(size_t position, uint64_t address, CacheDataType side,
+                               bool& dirtyLine) {
+    if (position > levels.size()) {
+        memoryReads++;
+        charge(side, position, memoryLatency);
+        return memoryLatency;
+    }
+
+    Cache& cache = *levels[position - 1];
+    uint64_t latency = cache.config.hitLatency;
+    charge(side, position, latency);
+
+    if (exclusive(position)) {
+        // the block moves up and leaves this level
+        if (cache.lookup(address).hit) {
+            dirtyLine = cache.invalidate(address);
+            return latency;
+        }
+        return latency + fetch(position + 1, address, side, dirtyLine);
+    }
+
+    CacheAccess result = cache.access(address, CACHE_READ);
+    if (result.hit) return latency;
+    latency += fetch(position + 1, address, side, dirtyLine);
+    if (dirtyLine) {
+        // this level now holds the only copy of the data that came up
+        cache.fill(address, true);
+        dirtyLine = false;
+    }
+    uint64_t writeback = evict(position, result, side);
+    charge(side, 0, writeback);
+    return latency + writeback;
+}
+
+uint64_t CacheHierarchy::evict(size_t position, const CacheAccess& fill, CacheDataType side) {
+    if (!fill.evicted) return 0;
+    Cache& cache = at(position, side);
+    bool dirtyLine = fill.writeback;
+    if (position > 0 && cache.config.inclusion == INCLUSION_INCLUSIVE) {
+        dirtyLine = invalidateAbove(position, fill.victimAddress) || dirtyLine;
+    }
+    // an exclusive level below takes clean victims too
+    if (dirtyLine || exclusive(position + 1)) {
+        writeDown(position + 1, fill.victimAddress, dirtyLine, side);
+    }
+    return dirtyLine ? cache.config.writebackLatency : 0;
+}
+
+uint64_t CacheHierarchy::evictL1(const CacheAccess& fill, CacheDataType side) {
+    Cache* victim = victims[side];
+    if (!victim || !fill.evicted) return evict(0, fill, side);
+    return evict(0, victim->fill(fill.victimAddress, fill.writeback), side);
+}
+
+void CacheHierarchy::writeDown(size_t position, uint64_t address, bool dirtyLine,
+                               CacheDataType side) {
+    if (position > levels.size()) {
+        if (dirtyLine) memoryWrites++;
+        return;
+    }
+    Cache& cache = *levels[position - 1];
+    if (!exclusive(position) && !cache.config.writeAllocate && !cache.probe(address)) {
+        writeDown(position + 1, address, dirtyLine, side);
+        return;
+    }
+    // a write-through level keeps a clean copy and passes the data on
+    bool through = dirtyLine && !cache.config.writeBack;
+    // victims this causes are written back off the miss path, so their latency is not paid
+    evict(position, cache.fill(address, dirtyLine && !through), side);
+    if (through) writeDown(position + 1, address, true, side);
+}
+
+bool CacheHierarchy::invalidateAbove(size_t position, uint64_t address) {
+    uint64_t blockSize = levels[position - 1]->config.blockSize;
+    std::vector<Cache*> above = {l1[I_CACHE], l1[D_CACHE]};
+    for (Cache* victim : victims) {
+        if (victim) above.push_back(victim);
+    }
+    above.insert(above.end(), levels.begin(), levels.begin() + (position - 1));
+
+    bool dirtyLine = false;
+    for (Cache* cache : above) {
+        // the levels above may use smaller blocks
+        for (uint64_t offset = 0; offset < blockSize; offset += cache->config.blockSize) {
+            if (!cache->probe(address + offset)) continue;
+            backInvalidations++;
+            dirtyLine = cache->invalidate(address + offset) || dirtyLine;
+        }
+    }
+    return dirtyLine;
+}
+
+void CacheHierarchy::resetStats() {
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        l1[side]->resetStats();
+        if (victims[side]) victims[side]->resetStats();
+        std::fill(missCycles[side].begin(), missCycles[side].end(), 0);
+        PrefetchState& state = prefetch[side];
+        state.issued = state.useful = state.late = state.polluting = 0;
+        if (classifier[side]) {
+            classifier[side]->compulsory = 0;
+            classifier[side]->capacityMisses = 0;
+            classifier[side]->conflict = 0;
+        }
+    }
+    for (Cache* level : levels) level->resetStats();
+    memoryReads = memoryWrites = backInvalidations = 0;
+}
+
+Status CacheHierarchy::dumpStats(const std::string& base_output_name) const {
+    bool any = !levels.empty();
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        any = any || prefetch[side].prefetcher || victims[side] || classifier[side];
+    }
+    if (!any) return SUCCESS;
+    std::ofstream simStats(base_output_name + "_sim_stats.out", std::ios::app);
+    if (!simStats) {
+        std::cerr << LOG_ERROR << "Could not open sim stats file!" << std::endl;
+        return ERROR;
+    }
+
+    if (!levels.empty()) {
+        for (size_t i = 0; i < levels.size(); i++) {
+            std::string name = "L" + std::to_string(i + 2);
+            simStats << std::left << std::setw(23) << name + " hits: " << levels[i]->getHits() << std::endl;
+            simStats << std::left << std::setw(23) << name + " misses: " << levels[i]->getMisses() << std::endl;
+            simStats << std::left << std::setw(23) << name + " writebacks: " << levels[i]->getWritebacks() << std::endl;
+        }
+        simStats << std::left << std::setw(23) << "Memory reads: "        << memoryReads << std::endl;
+        simStats << std::left << std::setw(23) << "Memory writes: "       << memoryWrites << std::endl;
+        simStats << std::left << std::setw(23) << "Back-invalidations: "  << backInvalidations << std::endl;
+
+        // AMAT = L1 hit time (one cycle in MEM or IF) + cycles spent below the L1 per access
+        const char* sideNames[2] = {"I-side AMAT: ", "D-side AMAT: "};
+        for (int side = I_CACHE; side <= D_CACHE; side++) {
+            const std::vector<uint64_t>& cycles = missCycles[side];
+            uint64_t accesses = l1[side]->getHits() + l1[side]->getMisses();
+            double perAccess = accesses ? 1.0 / accesses : 0.0;
+            double amat = 1.0;
+            for (uint64_t part : cycles) amat += part * perAccess;
+
+            simStats << std::left << std::setw(23) << sideNames[side] << std::fixed
+                     << std::setprecision(3) << amat << " (L1 1.000";
+            for (size_t i = 1; i <= levels.size(); i++) {
+                simStats << ", L" << i + 1 << ' ' << cycles[i] * perAccess;
+            }
+            simStats << ", memory " << cycles[levels.size() + 1] * perAccess << ", writeback "
+                     << cycles[0] * perAccess;
+            if (victims[side]) simStats << ", victim " << cycles[levels.size() + 2] * perAccess;
+            simStats << ')' << std::endl;
+        }
+    }
+
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        const PrefetchState& state = prefetch[side];
+        if (!state.prefetcher) continue;
+        std::string name = side == I_CACHE ? "I-prefetch " : "D-prefetch ";
+        // accuracy: issued prefetches that were demanded; coverage: demand misses removed
+        uint64_t demanded = state.useful + state.late;
+        double accuracy = state.issued ? static_cast<double>(demanded) / state.issued : 0.0;
+        uint64_t wouldMiss = demanded + l1[side]->getMisses();
+        double coverage = wouldMiss ? static_cast<double>(demanded) / wouldMiss : 0.0;
+        simStats << std::left << std::setw(23) << name + "issued: "    << state.issued << std::endl;
+        simStats << std::left << std::setw(23) << name + "useful: "    << state.useful << std::endl;
+        simStats << std::left << std::setw(23) << name + "late: "      << state.late << std::endl;
+        simStats << std::left << std::setw(23) << name + "polluting: " << state.polluting << std::endl;
+        simStats << std::left << std::setw(23) << name + "accuracy: "  << std::fixed
+                 << std::setprecision(3) << accuracy << std::endl;
+        simStats << std::left << std::setw(23) << name + "coverage: "  << coverage << std::endl;
+    }
+
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        Cache* victim = victims[side];
+        if (!victim) continue;
+        std::string name = side == I_CACHE ? "I-victim " : "D-victim ";
+        // the victim cache is looked up on every L1 miss that fills
+        uint64_t lookups = victim->getHits() + victim->getMisses();
+        double hitRate = lookups ? static_cast<double>(victim->getHits()) / lookups : 0.0;
+        simStats << std::left << std::setw(23) << name + "hits: "     << victim->getHits() << std::endl;
+        simStats << std::left << std::setw(23) << name + "misses: "   << victim->getMisses() << std::endl;
+        simStats << std::left << std::setw(23) << name + "hit rate: " << std::fixed
+                 << std::setprecision(3) << hitRate << std::endl;
+    }
+
+    for (int side = I_CACHE; side <= D_CACHE; side++) {
+        const MissClassifier* misses = classifier[side];
+        if (!misses) continue;
+        std::string name = side == I_CACHE ? "I-cache " : "D-cache ";
+        simStats << std::left << std::setw(23) << name + "compulsory: " << misses->compulsory << std::endl;
+        simStats << std::left << std::setw(23) << name + "capacity: "   << misses->capacityMisses << std::endl;
+        simStats << std::left << std::setw(23) << name + "conflict: "   << misses->conflict << std::endl;
+    }
+    return SUCCESS;
+}
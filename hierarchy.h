@@ -0,0 +1,139 @@
+#pragma once
+#include <inttypes.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Utilities.h"
+#include "cache.h"
+#include "prefetch.h"
+#include "stackdist.h"
+
+// What one access through the hierarchy means for the timing model
+struct MemoryAccess {
+    // the L1 hit
+    bool hit;
+    // the access waits for a fill; false for hits and write-around stores
+    bool stall;
+    // cycles the fill takes
+    uint64_t latency;
+};
+
+/** The split L1s and the unified levels they miss into, memory behind the last.
+ * An L1 miss pays the hit latency of every level it looks up, memory latency if
+ * the last level misses too, and the writeback latency of each level whose fill
+ * evicts a dirty line. Without lower levels it pays the L1's own missLatency.
+ * Inclusion is kept per level: an inclusive level invalidates the blocks above it
+ * that it evicts, an exclusive one takes the victims of the level above and gives
+ * its blocks up when they move up, and a NINE level does neither.
+ * An L1 with a prefetcher fills the blocks it asks for through the same path. Its
+ * prefetches go one at a time, and a demand miss waits for the one in flight.
+ * An L1 with a victim cache puts its victims there first. A miss that finds its block
+ * in the victim cache swaps it with the L1 victim in victimLatency cycles instead of
+ * going below, and the blocks the victim cache drops leave like L1 victims.
+ */
+class CacheHierarchy {
+   private:
+    Cache* l1[2];  // indexed by CacheDataType, not owned
+    std::vector<Cache*> levels;
+    uint64_t memoryLatency;
+
+    // Cycles spent below the L1s per side: [0] dirty writebacks, [1 ... levels.size()]
+    // lookups in each lower level, [levels.size() + 1] memory, [levels.size() + 2]
+    // victim cache swaps
+    std::vector<uint64_t> missCycles[2];
+    uint64_t memoryReads = 0;
+    uint64_t memoryWrites = 0;
+    uint64_t backInvalidations = 0;
+
+    // Per side: the prefetcher (or nullptr), prefetched blocks not demanded yet with the
+    // cycle their data arrives, blocks prefetch fills evicted, and when the miss path
+    // is done with the demand fills and prefetches queued on it
+    struct PrefetchState {
+        Prefetcher* prefetcher = nullptr;
+        std::unordered_map<uint64_t, uint64_t> unused;
+        std::unordered_set<uint64_t> displaced;
+        uint64_t pathFreeAt = 0;
+        std::vector<uint64_t> candidates;
+        uint64_t issued = 0;
+        uint64_t useful = 0;     // demanded after their data arrived
+        uint64_t late = 0;       // demanded while still in flight
+        uint64_t polluting = 0;  // evicted a block that missed again later
+    };
+    PrefetchState prefetch[2];
+    // prefetch fills do not count towards the demand AMAT
+    bool prefetching = false;
+
+    // Per side: the fully associative victim cache and the 3C miss classifier, or nullptr
+    Cache* victims[2] = {nullptr, nullptr};
+    MissClassifier* classifier[2] = {nullptr, nullptr};
+
+    void charge(CacheDataType side, size_t part, uint64_t cycles) {
+        if (!prefetching) missCycles[side][part] += cycles;
+    }
+
+    // position 0 is the L1 of side, position i the level levels[i - 1]
+    Cache& at(size_t position, CacheDataType side) {
+        return position == 0 ? *l1[side] : *levels[position - 1];
+    }
+    bool exclusive(size_t position) const {
+        return position >= 1 && position <= levels.size() &&
+               levels[position - 1]->config.inclusion == INCLUSION_EXCLUSIVE;
+    }
+
+    /** Bring the block of address up from position on
+     * @param dirtyLine set if the block comes up dirty out of an exclusive level
+     * @return the cycles it takes
+     */
+    uint64_t fetch(size_t position, uint64_t address, CacheDataType side, bool& dirtyLine);
+    // Pass on the line the fill of the cache at position evicted
+    // @return the writeback latency the fill waits for
+    uint64_t evict(size_t position, const CacheAccess& fill, CacheDataType side);
+    // Same for a fill of the L1 of side, whose victims go to its victim cache if it has one
+    uint64_t evictL1(const CacheAccess& fill, CacheDataType side);
+    // Deliver a block (dirty data or an exclusive victim) to position and below
+    void writeDown(size_t position, uint64_t address, bool dirtyLine, CacheDataType side);
+    // Bring the block of address into the L1 of side for its prefetcher
+    // @return the cycles it takes
+    uint64_t prefetchFill(CacheDataType side, uint64_t block);
+    // Invalidate the block of address in every cache above position
+    // @return whether any of the copies was dirty
+    bool invalidateAbove(size_t position, uint64_t address);
+
+   public:
+    // iCache and dCache stay owned by the caller
+    CacheHierarchy(Cache* iCache, Cache* dCache, const HierarchyConfig& config);
+    ~CacheHierarchy();
+    CacheHierarchy(const CacheHierarchy&) = delete;
+    CacheHierarchy& operator=(const CacheHierarchy&) = delete;
+
+    /** Access the L1 of side and, on a miss, the levels below it
+     * @param
+     *      pc: PC of the fetch or of the load/store, for the prefetcher
+     *      now: current cycle, for prefetches in flight
+     */
+    MemoryAccess access(CacheDataType side, uint64_t address, CacheOperation readWrite,
+                        uint64_t pc, uint64_t now);
+
+    size_t numLevels() const { return levels.size(); }
+
+    // Write the contents of every cache (L1s, victim caches and lower levels) to a
+    // checkpoint, or read them back. Prefetcher tables and counters are not saved.
+    void saveState(std::ostream& out) const;
+    // @return false if the checkpoint was taken with another hierarchy
+    bool restoreState(std::istream& in);
+
+    // Zero the counters of every cache, the prefetchers and the 3C breakdown, keeping
+    // the contents warm
+    void resetStats();
+
+    // Sort the misses of both L1s into compulsory, capacity and conflict misses
+    void classifyMisses();
+
+    // Append per-level hits, misses and writebacks, the average memory access time of
+    // each side, the prefetch and victim cache counters and the 3C breakdown to
+    // <base>_sim_stats.out, if there are any
+    Status dumpStats(const std::string& base_output_name) const;
+};
@@ -0,0 +1,234 @@
+#include "native.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+// ===== Memory helpers called from host code =====
+// Same semantics as opLoad/opStore in block.cpp.
+
+// sizeAndSign: access size in bytes, | 0x100 for sign-extending loads
+static uint64_t nativeLoad(BlockState* s, uint64_t address, uint64_t sizeAndSign) {
+    uint64_t value;
+    MemEntrySize size = static_cast<MemEntrySize>(sizeAndSign & 0xFF);
+    if (s->memory->getMemValue(address, value, size) != 0) return 0;
+    return (sizeAndSign & 0x100) ? sext64(value, size * 8 - 1) : value;
+}
+
+// @return 1 if the store hit translated code and the block has to be left
+static uint64_t nativeStore(BlockState* s, uint64_t address, uint64_t value, uint64_t size) {
+    if (s->memory->setMemValue(address, value, static_cast<MemEntrySize>(size)) != 0) return 0;
+    s->engine->storeDone(address, size);
+    if (s->engine->isCode(address, size)) {
+        s->codeModified = true;
+        return 1;
+    }
+    return 0;
+}
+
+// ===== x86-64 code generation =====
+// rbx holds the guest register array and r12 the BlockState; rax, rcx, rdx, rsi and
+// rdi are scratch. Guest register r lives at [rbx + 8 * r].
+
+enum HostReg { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+
+#if defined(__x86_64__)
+
+NativeBackend::NativeBackend() : code(nullptr), used(0) {
+    void* mem = mmap(nullptr, NATIVE_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) code = static_cast<uint8_t*>(mem);
+}
+
+NativeBackend::~NativeBackend() {
+    if (code) munmap(code, NATIVE_CODE_SIZE);
+}
+
+#else
+
+NativeBackend::NativeBackend() : code(nullptr), used(0) {}
+NativeBackend::~NativeBackend() {}
+
+#endif
+
+void NativeBackend::emit(std::initializer_list<uint8_t> bytes) {
+    buf.insert(buf.end(), bytes);
+}
+
+void NativeBackend::emit32(uint32_t value) {
+    for (int i = 0; i < 4; i++) buf.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+void NativeBackend::emit64(uint64_t value) {
+    for (int i = 0; i < 8; i++) buf.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+// mov host, [rbx + 8 * guest]
+void NativeBackend::loadReg(int hostReg, uint8_t guestReg) {
+    emit({0x48, 0x8B, static_cast<uint8_t>(0x83 | (hostReg << 3))});
+    emit32(8 * guestReg);
+}
+
+// mov [rbx + 8 * guest], host
+void NativeBackend::storeReg(uint8_t guestReg, int hostReg) {
+    emit({0x48, 0x89, static_cast<uint8_t>(0x83 | (hostReg << 3))});
+    emit32(8 * guestReg);
+}
+
+// mov host, imm64
+void NativeBackend::movImm(int hostReg, uint64_t imm) {
+    emit({0x48, static_cast<uint8_t>(0xB8 + hostReg)});
+    emit64(imm);
+}
+
+// mov rdi, r12; mov rax, helper; call rax
+void NativeBackend::callHelper(const void* helper) {
+    emit({0x4C, 0x89, 0xE7});
+    movImm(RAX, reinterpret_cast<uint64_t>(helper));
+    emit({0xFF, 0xD0});
+}
+
+// pop r13; pop r12; pop rbx; ret (the next guest PC is already in rax)
+void NativeBackend::epilogue() {
+    emit({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+}
+
+// @return false if the op has no host translation
+bool NativeBackend::emitOp(const MicroOp& op) {
+    // Register-register and register-immediate ALU ops: rax = rs1, rcx = rs2 or imm
+    static const struct {
+        uint8_t bytes[7];
+        uint8_t length;
+    } alu[] = {
+        {{0x48, 0x01, 0xC8}, 3},                                  // add rax, rcx
+        {{0x48, 0x29, 0xC8}, 3},                                  // sub rax, rcx
+        {{0x48, 0xD3, 0xE0}, 3},                                  // shl rax, cl
+        {{0x48, 0x39, 0xC8, 0x0F, 0x9C, 0xC0}, 6},                // cmp; setl al
+        {{0x48, 0x39, 0xC8, 0x0F, 0x92, 0xC0}, 6},                // cmp; setb al
+        {{0x48, 0x31, 0xC8}, 3},                                  // xor rax, rcx
+        {{0x48, 0xD3, 0xE8}, 3},                                  // shr rax, cl
+        {{0x48, 0xD3, 0xF8}, 3},                                  // sar rax, cl
+        {{0x48, 0x09, 0xC8}, 3},                                  // or rax, rcx
+        {{0x48, 0x21, 0xC8}, 3},                                  // and rax, rcx
+        {{0x01, 0xC8, 0x48, 0x63, 0xC0}, 5},                      // add eax, ecx; movsxd
+        {{0x29, 0xC8, 0x48, 0x63, 0xC0}, 5},                      // sub eax, ecx; movsxd
+        {{0xD3, 0xE0, 0x48, 0x63, 0xC0}, 5},                      // shl eax, cl; movsxd
+        {{0xD3, 0xE8, 0x48, 0x63, 0xC0}, 5},                      // shr eax, cl; movsxd
+        {{0xD3, 0xF8, 0x48, 0x63, 0xC0}, 5},                      // sar eax, cl; movsxd
+    };
+    // Condition codes for cmovcc, in UOP_BEQ..UOP_BGEU order: e, ne, l, ge, b, ae
+    static const uint8_t branchCondition[] = {0x4, 0x5, 0xC, 0xD, 0x2, 0x3};
+    // Immediate forms map onto the register-register table
+    static const MicroOpKind immToReg[] = {UOP_ADD, UOP_SLL, UOP_SLT, UOP_SLTU, UOP_XOR,
+                                           UOP_SRL, UOP_SRA, UOP_OR, UOP_AND, UOP_ADDW,
+                                           UOP_SLLW, UOP_SRLW, UOP_SRAW};
+
+    if (op.kind <= UOP_SRAIW) {
+        if (op.rd == 0) return true;
+        int entry = op.kind;
+        loadReg(RAX, op.rs1);
+        if (op.kind >= UOP_ADDI) {
+            entry = immToReg[op.kind - UOP_ADDI];
+            movImm(RCX, op.imm);
+        } else {
+            loadReg(RCX, op.rs2);
+        }
+        buf.insert(buf.end(), alu[entry].bytes, alu[entry].bytes + alu[entry].length);
+        if (entry == UOP_SLT || entry == UOP_SLTU) emit({0x48, 0x0F, 0xB6, 0xC0});  // movzx rax, al
+        storeReg(op.rd, RAX);
+        return true;
+    }
+
+    switch (op.kind) {
+        case UOP_BEQ:
+        case UOP_BNE:
+        case UOP_BLT:
+        case UOP_BGE:
+        case UOP_BLTU:
+        case UOP_BGEU:
+            loadReg(RAX, op.rs1);
+            loadReg(RCX, op.rs2);
+            emit({0x48, 0x39, 0xC8});  // cmp rax, rcx
+            movImm(RAX, op.PC + 4);
+            movImm(RDX, op.imm);
+            emit({0x48, 0x0F, static_cast<uint8_t>(0x40 | branchCondition[op.kind - UOP_BEQ]), 0xC2});
+            epilogue();
+            return true;
+        case UOP_LOAD:
+        case UOP_LOAD_SIGNED:
+            loadReg(RSI, op.rs1);
+            movImm(RCX, op.imm);
+            emit({0x48, 0x01, 0xCE});  // add rsi, rcx
+            emit({0xBA});              // mov edx, sizeAndSign
+            emit32(op.size | (op.kind == UOP_LOAD_SIGNED ? 0x100 : 0));
+            callHelper(reinterpret_cast<const void*>(&nativeLoad));
+            if (op.rd != 0) storeReg(op.rd, RAX);
+            return true;
+        case UOP_STORE:
+            loadReg(RSI, op.rs1);
+            movImm(RCX, op.imm);
+            emit({0x48, 0x01, 0xCE});  // add rsi, rcx
+            loadReg(RDX, op.rs2);
+            emit({0xB9});              // mov ecx, size
+            emit32(op.size);
+            callHelper(reinterpret_cast<const void*>(&nativeStore));
+            // test rax, rax; jz past the early exit (mov rax, imm64 + epilogue = 16 bytes)
+            emit({0x48, 0x85, 0xC0, 0x74, 0x10});
+            movImm(RAX, op.PC + 4);
+            epilogue();
+            return true;
+        case UOP_LOAD_IMM:
+            if (op.rd != 0) {
+                movImm(RAX, op.imm);
+                storeReg(op.rd, RAX);
+            }
+            return true;
+        case UOP_NOP:
+            return true;
+        case UOP_JAL:
+            if (op.rd != 0) {
+                movImm(RAX, op.PC + 4);
+                storeReg(op.rd, RAX);
+            }
+            movImm(RAX, op.imm);
+            epilogue();
+            return true;
+        case UOP_JALR:
+            loadReg(RAX, op.rs1);
+            movImm(RCX, op.imm);
+            emit({0x48, 0x01, 0xC8});        // add rax, rcx
+            emit({0x48, 0x83, 0xE0, 0xFE});  // and rax, -2
+            if (op.rd != 0) {
+                movImm(RCX, op.PC + 4);
+                storeReg(op.rd, RCX);
+            }
+            epilogue();
+            return true;
+        case UOP_EXIT:
+            movImm(RAX, op.imm);
+            epilogue();
+            return true;
+        default:
+            // halt and illegal instructions stay on the micro-op path
+            return false;
+    }
+}
+
+NativeBlock NativeBackend::compile(const Block& block) {
+    if (!code) return nullptr;
+
+    buf.clear();
+    // push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi
+    emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+    for (const MicroOp& op : block.ops) {
+        if (!emitOp(op)) return nullptr;
+    }
+
+    if (used + buf.size() > NATIVE_CODE_SIZE) return nullptr;
+    uint8_t* entry = code + used;
+    memcpy(entry, buf.data(), buf.size());
+    used += buf.size();
+    return reinterpret_cast<NativeBlock>(entry);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <initializer_list>
+#include <vector>
+
+#include "block.h"
+
+// Size of the executable buffer native blocks are emitted into (4 MB)
+#define NATIVE_CODE_SIZE (4 << 20)
+// Executions of a block before it is compiled to host code
+#define NATIVE_HOT_THRESHOLD 16
+
+// x86-64 dynamic binary translation backend for BlockEngine. Guest registers stay in
+// the simulator's regData array and every load/store goes through a helper that uses
+// the bounds-checked MemoryStore accessors. Blocks it cannot compile (halt, illegal
+// instructions, or a full code buffer) keep running as micro-ops.
+class NativeBackend {
+   private:
+    uint8_t* code;
+    size_t used;
+
+    // host code of the block being compiled
+    std::vector<uint8_t> buf;
+
+    void emit(std::initializer_list<uint8_t> bytes);
+    void emit32(uint32_t value);
+    void emit64(uint64_t value);
+    void loadReg(int hostReg, uint8_t guestReg);
+    void storeReg(uint8_t guestReg, int hostReg);
+    void movImm(int hostReg, uint64_t imm);
+    void callHelper(const void* helper);
+    void epilogue();
+    bool emitOp(const MicroOp& op);
+
+   public:
+    NativeBackend();
+    ~NativeBackend();
+
+    // false when there is no executable buffer (non-x86-64 host or mmap failure)
+    bool available() const { return code != nullptr; }
+
+    // @return the compiled block, or nullptr if it has to stay on micro-ops
+    NativeBlock compile(const Block& block);
+
+    // forget all compiled blocks (BlockEngine flushed its translations)
+    void flush() { used = 0; }
+};
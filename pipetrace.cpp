@@ -0,0 +1,43 @@
+/** NOTE pipe trace renderer
+ * Renders a binary pipe trace written by `sim_cycle --trace=binary` back into the
+ * text format of <base>_pipe_state.out. The disassembly is only done here, so the
+ * simulator itself never pays for it.
+ */
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Utilities.h"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        cerr << LOG_ERROR << "Usage: " << argv[0] << " <trace_pipe_state.bin> [output.out]"
+             << endl;
+        return ERROR;
+    }
+
+    PipeTraceReader reader;
+    if (reader.open(argv[1]) != SUCCESS) return ERROR;
+
+    // By default fib_cycle_pipe_state.bin is rendered into fib_cycle_pipe_state.out
+    string outputFile = argc == 3 ? argv[2] : getBaseFilename(argv[1]) + ".out";
+    ofstream pipe_out(outputFile);
+    if (!pipe_out) {
+        cerr << LOG_ERROR << "Could not open output file " << outputFile << endl;
+        return ERROR;
+    }
+
+    PipeState state{};
+    uint64_t records = 0;
+    while (reader.next(state)) {
+        printPipeState(state, pipe_out);
+        pipe_out << '\n';
+        records++;
+    }
+
+    cout << "[pipetrace] Rendered " << records << " cycles into " << outputFile << endl;
+    return SUCCESS;
+}
@@ -0,0 +1,139 @@
+#include "prefetch.h"
+
+static const char* const PREFETCHER_NAMES[PREFETCH_COUNT] = {"none", "next-line", "stride",
+                                                             "stream"};
+
+const char* prefetcherName(PrefetchKind kind) {
+    return kind < PREFETCH_COUNT ? PREFETCHER_NAMES[kind] : "unknown";
+}
+
+bool parsePrefetcher(const std::string& name, PrefetchKind& kind) {
+    for (int i = 0; i < PREFETCH_COUNT; i++) {
+        if (name == PREFETCHER_NAMES[i]) {
+            kind = static_cast<PrefetchKind>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tagged next-line: a miss or the first hit on a prefetched block fetches the blocks
+// after it, so a sequential walk stays ahead once it has started
+class NextLinePrefetcher : public Prefetcher {
+   public:
+    using Prefetcher::Prefetcher;
+
+    void observe(uint64_t, uint64_t address, bool miss, bool prefetchHit,
+                 std::vector<uint64_t>& out) override {
+        if (!miss && !prefetchHit) return;
+        uint64_t block = address & ~(blockSize - 1);
+        for (uint64_t i = 0; i < degree; i++) out.push_back(block + (distance + i) * blockSize);
+    }
+};
+
+// Reference prediction table (Chen and Baer): one entry per load/store PC holding its
+// last address and stride. Two accesses in a row with the same stride make the entry
+// steady, and a steady entry prefetches distance ... distance + degree - 1 strides ahead.
+class StridePrefetcher : public Prefetcher {
+   private:
+    enum State : uint8_t { INITIAL, TRANSIENT, STEADY, NO_PREDICTION };
+    struct Entry {
+        uint64_t pc = 0;
+        uint64_t lastAddress = 0;
+        int64_t stride = 0;
+        State state = INITIAL;
+        bool valid = false;
+    };
+    static const uint64_t TABLE_ENTRIES = 64;
+    std::vector<Entry> table;
+
+   public:
+    StridePrefetcher(uint64_t blockSize, uint64_t degree, uint64_t distance)
+        : Prefetcher(blockSize, degree, distance), table(TABLE_ENTRIES) {}
+
+    void observe(uint64_t pc, uint64_t address, bool, bool,
+                 std::vector<uint64_t>& out) override {
+        Entry& entry = table[(pc >> 2) & (TABLE_ENTRIES - 1)];
+        if (!entry.valid || entry.pc != pc) {
+            entry = Entry{pc, address, 0, INITIAL, true};
+            return;
+        }
+        int64_t stride = static_cast<int64_t>(address - entry.lastAddress);
+        bool correct = stride == entry.stride;
+        switch (entry.state) {
+            case INITIAL: entry.state = correct ? STEADY : TRANSIENT; break;
+            case TRANSIENT: entry.state = correct ? STEADY : NO_PREDICTION; break;
+            case STEADY: entry.state = correct ? STEADY : INITIAL; break;
+            case NO_PREDICTION: entry.state = correct ? TRANSIENT : NO_PREDICTION; break;
+        }
+        // a steady entry keeps its stride through one wrong guess
+        if (!correct && entry.state != INITIAL) entry.stride = stride;
+        entry.lastAddress = address;
+        if (entry.state != STEADY || entry.stride == 0) return;
+        for (uint64_t i = 0; i < degree; i++) {
+            out.push_back(address + static_cast<uint64_t>(entry.stride) * (distance + i));
+        }
+    }
+};
+
+// Stream detection on the miss stream: a miss in the block right after (or before) the
+// last block of a tracked stream confirms its direction and prefetches ahead of it.
+// Other misses start a new stream in place of the least recently used one.
+class StreamPrefetcher : public Prefetcher {
+   private:
+    struct Stream {
+        uint64_t lastBlock = 0;
+        int64_t direction = 0;  // +1 or -1 once confirmed
+        uint64_t lastUse = 0;
+        bool valid = false;
+    };
+    static const uint64_t STREAMS = 8;
+    std::vector<Stream> streams;
+    uint64_t misses = 0;
+
+   public:
+    StreamPrefetcher(uint64_t blockSize, uint64_t degree, uint64_t distance)
+        : Prefetcher(blockSize, degree, distance), streams(STREAMS) {}
+
+    void observe(uint64_t, uint64_t address, bool miss, bool prefetchHit,
+                 std::vector<uint64_t>& out) override {
+        if (!miss && !prefetchHit) return;
+        misses++;
+        uint64_t block = address / blockSize;
+        // a confirmed stream also follows misses that skip over blocks still in flight
+        int64_t reach = static_cast<int64_t>(distance + degree);
+        Stream* oldest = &streams[0];
+        for (Stream& stream : streams) {
+            if (!stream.valid) {
+                if (oldest->valid) oldest = &stream;
+                continue;
+            }
+            int64_t step = static_cast<int64_t>(block - stream.lastBlock);
+            bool follows = stream.direction == 0
+                               ? step == 1 || step == -1
+                               : step * stream.direction > 0 && step * stream.direction <= reach;
+            if (follows) {
+                if (stream.direction == 0) stream.direction = step;
+                stream.lastBlock = block;
+                stream.lastUse = misses;
+                for (uint64_t i = 0; i < degree; i++) {
+                    int64_t ahead = stream.direction * static_cast<int64_t>(distance + i);
+                    out.push_back((block + static_cast<uint64_t>(ahead)) * blockSize);
+                }
+                return;
+            }
+            if (oldest->valid && stream.lastUse < oldest->lastUse) oldest = &stream;
+        }
+        *oldest = Stream{block, 0, misses, true};
+    }
+};
+
+Prefetcher* makePrefetcher(PrefetchKind kind, uint64_t blockSize, uint64_t degree,
+                           uint64_t distance) {
+    switch (kind) {
+        case PREFETCH_NEXT_LINE: return new NextLinePrefetcher(blockSize, degree, distance);
+        case PREFETCH_STRIDE: return new StridePrefetcher(blockSize, degree, distance);
+        case PREFETCH_STREAM: return new StreamPrefetcher(blockSize, degree, distance);
+        default: return nullptr;
+    }
+}
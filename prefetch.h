@@ -0,0 +1,46 @@
+#pragma once
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+// Prefetcher watching the demand accesses of one L1
+enum PrefetchKind : uint8_t {
+    PREFETCH_NONE,
+    PREFETCH_NEXT_LINE,  // the blocks after a miss or a first hit on a prefetched block
+    PREFETCH_STRIDE,     // PC-indexed reference prediction table
+    PREFETCH_STREAM,     // ascending or descending runs of missing blocks
+    PREFETCH_COUNT
+};
+
+// "none", "next-line", "stride", "stream"
+const char* prefetcherName(PrefetchKind kind);
+// @return false if name is not one of the names above
+bool parsePrefetcher(const std::string& name, PrefetchKind& kind);
+
+// Turns the demand accesses of a cache into addresses to prefetch. Each trigger asks
+// for degree blocks, starting distance blocks (or strides) ahead of the access.
+class Prefetcher {
+   protected:
+    uint64_t blockSize;
+    uint64_t degree;
+    uint64_t distance;
+
+   public:
+    Prefetcher(uint64_t blockSize, uint64_t degree, uint64_t distance)
+        : blockSize(blockSize), degree(degree), distance(distance) {}
+    virtual ~Prefetcher() {}
+
+    /** Observe one demand access and append the addresses to prefetch to out
+     * @param
+     *      pc: PC of the instruction making the access
+     *      miss: the block was not in the cache
+     *      prefetchHit: the access is the first use of a prefetched block
+     */
+    virtual void observe(uint64_t pc, uint64_t address, bool miss, bool prefetchHit,
+                         std::vector<uint64_t>& out) = 0;
+};
+
+// @return a new prefetcher of kind, or nullptr for PREFETCH_NONE
+Prefetcher* makePrefetcher(PrefetchKind kind, uint64_t blockSize, uint64_t degree,
+                           uint64_t distance);
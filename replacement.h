@@ -0,0 +1,243 @@
+#pragma once
+#include <inttypes.h>
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "checkpoint.h"
+
+// Victim selection of a set whose ways are all valid. The cache itself fills
+// invalid ways first, in way order, before asking the policy.
+enum ReplacementPolicy : uint8_t {
+    REPL_LRU,        // true LRU, a recency rank per way
+    REPL_TREE_PLRU,  // binary tree of ways - 1 bits, needs a power-of-2 ways
+    REPL_BIT_PLRU,   // one MRU bit per way
+    REPL_FIFO,       // round-robin pointer per set
+    REPL_RANDOM,     // seeded xorshift, no per-set state
+    REPL_SRRIP,      // 2-bit re-reference prediction values, insert at long
+    REPL_BRRIP,      // SRRIP inserting at distant except one fill in 32
+    REPL_COUNT
+};
+
+// Replacement metadata of every set of one cache, packed into bitsPerSet bits
+// per set the way a hardware array would hold it. LRU ranks, which every hit
+// rewrites for the whole set, are kept as one 16-bit entry per way instead so the
+// update can run as a vector loop.
+class ReplacementState {
+   private:
+    std::vector<uint64_t> words;
+    std::vector<uint16_t> rankArray;
+    uint64_t bitsPerSet = 0;
+
+   public:
+    uint64_t ways = 0;
+    uint64_t rng = 1;  // xorshift64 state for REPL_RANDOM and REPL_BRRIP
+
+    void resize(uint64_t numSets, uint64_t numWays, uint64_t setBits, bool wayRanks) {
+        ways = numWays;
+        bitsPerSet = setBits;
+        // one spare word so a field straddling the last word boundary can be read
+        words.assign((numSets * bitsPerSet + 63) / 64 + 1, 0);
+        rankArray.assign(wayRanks ? numSets * numWays : 0, 0);
+    }
+
+    uint16_t* ranks(uint64_t set) { return rankArray.data() + set * ways; }
+
+    // the width-bit field at bit offset of set's metadata, width <= 32
+    uint64_t get(uint64_t set, uint64_t offset, unsigned width) const {
+        uint64_t pos = set * bitsPerSet + offset;
+        unsigned shift = pos & 63;
+        uint64_t value = words[pos >> 6] >> shift;
+        if (shift + width > 64) value |= words[(pos >> 6) + 1] << (64 - shift);
+        return value & ((1ULL << width) - 1);
+    }
+
+    void put(uint64_t set, uint64_t offset, unsigned width, uint64_t value) {
+        uint64_t pos = set * bitsPerSet + offset;
+        unsigned shift = pos & 63;
+        uint64_t mask = (1ULL << width) - 1;
+        uint64_t& low = words[pos >> 6];
+        low = (low & ~(mask << shift)) | ((value & mask) << shift);
+        if (shift + width > 64) {
+            uint64_t& high = words[(pos >> 6) + 1];
+            high = (high & ~(mask >> (64 - shift))) | ((value & mask) >> (64 - shift));
+        }
+    }
+
+    void saveState(std::ostream& out) const {
+        putVector(out, words);
+        putVector(out, rankArray);
+        putRaw(out, rng);
+    }
+
+    // @return false if the checkpoint was taken with another geometry or policy
+    bool restoreState(std::istream& in) {
+        return getVector(in, words) && getVector(in, rankArray) && getRaw(in, rng);
+    }
+
+    uint64_t random() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+};
+
+// bits needed to number ways 0 .. ways - 1
+inline unsigned wayBits(uint64_t ways) {
+    unsigned bits = 0;
+    while ((1ULL << bits) < ways) bits++;
+    return bits;
+}
+
+/** Replacement policies, used as the template argument of Cache::accessWith so each
+ * one compiles into its own lookup. Every policy provides
+ *      bitsPerSet(ways): metadata bits it needs per set
+ *      wayRanks: whether it uses ReplacementState::ranks
+ *      reset(state, set): metadata of a set before its first access
+ *      touch(state, set, way): a hit on way
+ *      insert(state, set, way): a fill into way
+ *      victim(state, set): the way to evict from a full set
+ */
+
+// Rank 0 is the most recently used way, rank ways - 1 the least recently used
+struct LruPolicy {
+    static const bool wayRanks = true;
+    static uint64_t bitsPerSet(uint64_t) { return 0; }
+    static void reset(ReplacementState& state, uint64_t set) {
+        uint16_t* rank = state.ranks(set);
+        for (uint64_t way = 0; way < state.ways; way++) rank[way] = static_cast<uint16_t>(way);
+    }
+    static void touch(ReplacementState& state, uint64_t set, uint64_t way) {
+        uint16_t* rank = state.ranks(set);
+        uint16_t used = rank[way];
+        if (used == 0) return;
+        for (uint64_t other = 0; other < state.ways; other++) rank[other] += rank[other] < used;
+        rank[way] = 0;
+    }
+    static void insert(ReplacementState& state, uint64_t set, uint64_t way) {
+        touch(state, set, way);
+    }
+    static uint64_t victim(ReplacementState& state, uint64_t set) {
+        const uint16_t* rank = state.ranks(set);
+        for (uint64_t way = 0; way < state.ways; way++) {
+            if (rank[way] == state.ways - 1) return way;
+        }
+        return 0;
+    }
+};
+
+// Node n of the tree has children 2n + 1 and 2n + 2; a 1 bit points the victim
+// search at the right half
+struct TreePlruPolicy {
+    static const bool wayRanks = false;
+    static uint64_t bitsPerSet(uint64_t ways) { return ways - 1; }
+    static void reset(ReplacementState&, uint64_t) {}
+    static void touch(ReplacementState& state, uint64_t set, uint64_t way) {
+        uint64_t node = 0;
+        uint64_t low = 0;
+        for (uint64_t size = state.ways; size > 1; size /= 2) {
+            uint64_t right = way >= low + size / 2;
+            // point away from the half that was just used
+            state.put(set, node, 1, !right);
+            node = 2 * node + 1 + right;
+            if (right) low += size / 2;
+        }
+    }
+    static void insert(ReplacementState& state, uint64_t set, uint64_t way) {
+        touch(state, set, way);
+    }
+    static uint64_t victim(ReplacementState& state, uint64_t set) {
+        uint64_t node = 0;
+        uint64_t low = 0;
+        for (uint64_t size = state.ways; size > 1; size /= 2) {
+            uint64_t right = state.get(set, node, 1);
+            node = 2 * node + 1 + right;
+            if (right) low += size / 2;
+        }
+        return low;
+    }
+};
+
+// A way's bit is set when it is used; once all are set, all others are cleared
+struct BitPlruPolicy {
+    static const bool wayRanks = false;
+    static uint64_t bitsPerSet(uint64_t ways) { return ways; }
+    static void reset(ReplacementState&, uint64_t) {}
+    static void touch(ReplacementState& state, uint64_t set, uint64_t way) {
+        state.put(set, way, 1, 1);
+        for (uint64_t other = 0; other < state.ways; other++) {
+            if (!state.get(set, other, 1)) return;
+        }
+        for (uint64_t other = 0; other < state.ways; other++) {
+            if (other != way) state.put(set, other, 1, 0);
+        }
+    }
+    static void insert(ReplacementState& state, uint64_t set, uint64_t way) {
+        touch(state, set, way);
+    }
+    static uint64_t victim(ReplacementState& state, uint64_t set) {
+        for (uint64_t way = 0; way < state.ways; way++) {
+            if (!state.get(set, way, 1)) return way;
+        }
+        return 0;
+    }
+};
+
+// The pointer names the oldest fill; hits leave it alone
+struct FifoPolicy {
+    static const bool wayRanks = false;
+    static uint64_t bitsPerSet(uint64_t ways) { return wayBits(ways); }
+    static void reset(ReplacementState&, uint64_t) {}
+    static void touch(ReplacementState&, uint64_t, uint64_t) {}
+    static void insert(ReplacementState& state, uint64_t set, uint64_t way) {
+        state.put(set, 0, wayBits(state.ways), (way + 1) % state.ways);
+    }
+    static uint64_t victim(ReplacementState& state, uint64_t set) {
+        return state.get(set, 0, wayBits(state.ways));
+    }
+};
+
+struct RandomPolicy {
+    static const bool wayRanks = false;
+    static uint64_t bitsPerSet(uint64_t) { return 0; }
+    static void reset(ReplacementState&, uint64_t) {}
+    static void touch(ReplacementState&, uint64_t, uint64_t) {}
+    static void insert(ReplacementState&, uint64_t, uint64_t) {}
+    static uint64_t victim(ReplacementState& state, uint64_t) {
+        return state.random() % state.ways;
+    }
+};
+
+// Static and bimodal re-reference interval prediction (Jaleel et al., ISCA 2010)
+// with 2-bit prediction values: 0 is near-immediate, 3 is distant
+template <bool bimodal>
+struct RripPolicy {
+    static const bool wayRanks = false;
+    static const uint64_t DISTANT = 3;
+    static uint64_t bitsPerSet(uint64_t ways) { return ways * 2; }
+    static void reset(ReplacementState& state, uint64_t set) {
+        for (uint64_t way = 0; way < state.ways; way++) state.put(set, way * 2, 2, DISTANT);
+    }
+    static void touch(ReplacementState& state, uint64_t set, uint64_t way) {
+        state.put(set, way * 2, 2, 0);
+    }
+    static void insert(ReplacementState& state, uint64_t set, uint64_t way) {
+        bool distant = bimodal && (state.random() & 31) != 0;
+        state.put(set, way * 2, 2, distant ? DISTANT : DISTANT - 1);
+    }
+    static uint64_t victim(ReplacementState& state, uint64_t set) {
+        while (true) {
+            for (uint64_t way = 0; way < state.ways; way++) {
+                if (state.get(set, way * 2, 2) == DISTANT) return way;
+            }
+            // nobody is distant yet: age the whole set and look again
+            for (uint64_t way = 0; way < state.ways; way++) {
+                state.put(set, way * 2, 2, state.get(set, way * 2, 2) + 1);
+            }
+        }
+    }
+};
+typedef RripPolicy<false> SrripPolicy;
+typedef RripPolicy<true> BrripPolicy;
@@ -16,9 +16,20 @@
 
 using namespace std;
 
-inline std::tuple<std::string, CacheConfig, CacheConfig> parseArgs(int argc, char** argv) {
-    if (argc != 3) {
-        std::cerr << LOG_ERROR << "Usage: " << argv[0] << " <file.bin> <cache_config.txt>"
+inline std::tuple<std::string, CacheConfig, CacheConfig, TraceConfig, CoreConfig,
+                  HierarchyConfig, CheckpointConfig, SamplingConfig>
+parseArgs(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << LOG_ERROR << "Usage: " << argv[0]
+                  << " <file.bin> <cache_config.txt> [--trace=text|binary|off]"
+                     " [--trace-window=<start>:<end> | --trace-every=<n> | --trace-events]"
+                     " [--no-skip] [--miss-curve] [--classify-misses]"
+                     " [--predictor=none|btfn|bimodal|gshare|tournament] [--btb-entries=<n>]"
+                     " [--ras-entries=<n>] [--predictor-bits=<n>] [--width=1|2|4]"
+                     " [--ooo] [--rob=<n>] [--iq=<n>] [--split-iq] [--lsq=<n>]"
+                     " [--restore=<file>] [--checkpoint=<file> --checkpoint-at=<cycles>"
+                     " [--checkpoint-caches] [--checkpoint-pipeline]]"
+                     " [--sample=<interval> [--sample-warmup=<n>] [--sample-unit=<n>] | --roi]"
                   << std::endl
                   << "Note:" << std::endl
                   << "The sim_cycle binary should take two command-line arguments indicating the "
@@ -32,38 +43,129 @@ inline std::tuple<std::string, CacheConfig, CacheConfig> parseArgs(int argc, cha
         std::string inputFile = argv[1];
         std::string cacheFile = argv[2];
 
-        std::ifstream file(cacheFile);
-        if (!file.is_open()) {
-            std::cerr << LOG_ERROR << "Failed to open cache config file: " << cacheFile
-                      << std::endl;
-            exit(ERROR);
-        }
-
-        int line = 0;
-        auto parseNextLine = [&](const char* name) -> uint32_t {
-            line++;
-            uint32_t value;
-            if (!(file >> value)) {
-                std::stringstream errorMessage;
-                errorMessage << "Failed to parse property at line " << line << " for property "
-                             << name;
-                throw std::invalid_argument(errorMessage.str());
+        TraceConfig trace;
+        CoreConfig core;
+        CheckpointConfig checkpoint;
+        SamplingConfig sampling;
+        bool traceOff = false;
+        int selectors = 0;
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--trace=text") {
+                trace.format = TRACE_TEXT;
+            } else if (arg == "--trace=binary") {
+                trace.format = TRACE_BINARY;
+            } else if (arg == "--trace=off") {
+                traceOff = true;
+            } else if (arg.compare(0, 15, "--trace-window=") == 0) {
+                std::string range = arg.substr(15);
+                size_t colon = range.find(':');
+                if (colon == std::string::npos) {
+                    throw std::invalid_argument("Expected --trace-window=<start>:<end>");
+                }
+                trace.mode = TRACE_WINDOW;
+                trace.windowStart = std::stoull(range.substr(0, colon));
+                trace.windowEnd = std::stoull(range.substr(colon + 1));
+                selectors++;
+            } else if (arg.compare(0, 14, "--trace-every=") == 0) {
+                trace.mode = TRACE_SAMPLED;
+                trace.interval = std::stoull(arg.substr(14));
+                if (trace.interval == 0) {
+                    throw std::invalid_argument("--trace-every needs a positive interval");
+                }
+                selectors++;
+            } else if (arg == "--trace-events") {
+                trace.mode = TRACE_EVENTS;
+                selectors++;
+            } else if (arg == "--no-skip") {
+                core.skipStalls = false;
+            } else if (arg == "--miss-curve") {
+                core.missCurves = true;
+            } else if (arg == "--classify-misses") {
+                core.classifyMisses = true;
+            } else if (arg.compare(0, 12, "--predictor=") == 0) {
+                if (!parsePredictor(arg.substr(12), core.predictor.kind)) {
+                    throw std::invalid_argument("Unknown predictor " + arg.substr(12));
+                }
+            } else if (arg.compare(0, 14, "--btb-entries=") == 0) {
+                core.predictor.btbEntries = std::stoull(arg.substr(14));
+            } else if (arg.compare(0, 14, "--ras-entries=") == 0) {
+                core.predictor.rasEntries = std::stoull(arg.substr(14));
+            } else if (arg.compare(0, 17, "--predictor-bits=") == 0) {
+                core.predictor.tableBits = std::stoull(arg.substr(17));
+            } else if (arg.compare(0, 8, "--width=") == 0) {
+                core.width = std::stoull(arg.substr(8));
+            } else if (arg == "--ooo") {
+                core.outOfOrder = true;
+            } else if (arg.compare(0, 6, "--rob=") == 0) {
+                core.ooo.robEntries = std::stoull(arg.substr(6));
+            } else if (arg.compare(0, 5, "--iq=") == 0) {
+                core.ooo.iqEntries = std::stoull(arg.substr(5));
+            } else if (arg == "--split-iq") {
+                core.ooo.splitQueues = true;
+            } else if (arg.compare(0, 6, "--lsq=") == 0) {
+                core.ooo.lsqEntries = std::stoull(arg.substr(6));
+            } else if (arg.compare(0, 10, "--restore=") == 0) {
+                checkpoint.restore = arg.substr(10);
+            } else if (arg.compare(0, 13, "--checkpoint=") == 0) {
+                checkpoint.save = arg.substr(13);
+            } else if (arg.compare(0, 16, "--checkpoint-at=") == 0) {
+                checkpoint.saveAt = std::stoull(arg.substr(16));
+            } else if (arg == "--checkpoint-caches") {
+                checkpoint.caches = true;
+            } else if (arg == "--checkpoint-pipeline") {
+                checkpoint.pipeline = true;
+            } else if (arg.compare(0, 9, "--sample=") == 0) {
+                sampling.interval = std::stoull(arg.substr(9));
+            } else if (arg.compare(0, 16, "--sample-warmup=") == 0) {
+                sampling.warmup = std::stoull(arg.substr(16));
+            } else if (arg.compare(0, 14, "--sample-unit=") == 0) {
+                sampling.unit = std::stoull(arg.substr(14));
+            } else if (arg == "--roi") {
+                sampling.region = true;
+            } else {
+                throw std::invalid_argument("Unknown option " + arg);
             }
-            std::string discard;
-            std::getline(file, discard);  // discard rest of the line
-            return value;
-        };
-
-        CacheConfig icConfig{parseNextLine("ICache cache size"), parseNextLine("ICache block size"),
-                             parseNextLine("ICache ways"), parseNextLine("ICache miss latency")};
+        }
+        if (selectors > 1) {
+            throw std::invalid_argument(
+                "Only one of --trace-window, --trace-every and --trace-events may be given");
+        }
+        if (traceOff) trace.mode = TRACE_OFF;
+        if (checkpoint.save.empty() &&
+            (checkpoint.saveAt > 0 || checkpoint.caches || checkpoint.pipeline)) {
+            throw std::invalid_argument("--checkpoint-* options need --checkpoint=<file>");
+        }
+        if (checkpoint.pipeline && (core.width > 1 || core.outOfOrder)) {
+            throw std::invalid_argument("--checkpoint-pipeline needs the scalar pipeline");
+        }
 
-        CacheConfig dcConfig{parseNextLine("DCache cache size"), parseNextLine("DCache block size"),
-                             parseNextLine("DCache ways"), parseNextLine("DCache miss latency")};
+        CacheConfig icConfig;
+        CacheConfig dcConfig;
+        HierarchyConfig hierarchy;
+        readCacheConfigs(cacheFile, icConfig, dcConfig, &hierarchy);
 
         std::cout << LOG_INFO << LOG_VAR(icConfig) << std::endl;
         std::cout << LOG_INFO << LOG_VAR(dcConfig) << std::endl;
+        std::string error = checkCoreConfig(core, dcConfig);
+        if (!error.empty()) throw std::invalid_argument(error);
+        error = checkSamplingConfig(sampling);
+        if (!error.empty()) throw std::invalid_argument(error);
+        if (sampling.region && !checkpoint.save.empty()) {
+            throw std::invalid_argument("--roi runs cannot take a checkpoint");
+        }
+        for (size_t i = 0; i < hierarchy.levels.size(); i++) {
+            std::cout << LOG_INFO << "L" << i + 2 << ": " << hierarchy.levels[i] << std::endl;
+        }
+        if (!hierarchy.levels.empty()) {
+            std::cout << LOG_INFO << LOG_VAR(hierarchy.memoryLatency) << std::endl;
+        }
+        // the L1s are checked even without lower levels
+        error = checkHierarchyConfig(icConfig, dcConfig, hierarchy);
+        if (!error.empty()) throw std::invalid_argument(error);
 
-        return std::make_tuple(inputFile, icConfig, dcConfig);
+        return std::make_tuple(inputFile, icConfig, dcConfig, trace, core, hierarchy,
+                               checkpoint, sampling);
 
     } catch (const std::invalid_argument& e) {
         std::cerr << LOG_ERROR << e.what() << std::endl;
@@ -79,14 +181,42 @@ int main(int argc, char** argv) {
     auto inputFile = std::get<0>(simArgs);
     auto iCacheConfig = std::get<1>(simArgs);
     auto dCacheConfig = std::get<2>(simArgs);
+    auto trace = std::get<3>(simArgs);
+    auto core = std::get<4>(simArgs);
+    auto hierarchy = std::get<5>(simArgs);
+    auto checkpoint = std::get<6>(simArgs);
+    auto sampling = std::get<7>(simArgs);
 
     cout << "[Simulator] Loading memory from " << LOG_VAR(inputFile) << endl;
     auto baseFilename = getBaseFilename(argv[1]) + "_cycle";
     initSimulator(iCacheConfig, dCacheConfig, new MemoryStore(0, MEMORY_SIZE, argv[1]),
-                  baseFilename);
+                  baseFilename, trace, core, hierarchy);
+
+    if (!checkpoint.restore.empty()) {
+        cout << "[Simulator] Restoring " << LOG_VAR(checkpoint.restore) << endl;
+        if (restoreCheckpoint(checkpoint.restore) != SUCCESS) return ERROR;
+    }
 
     cout << "[Simulator] Start simulator" << endl;
-    auto status = runTillHalt();
+    Status status = SUCCESS;
+    if (!checkpoint.save.empty()) {
+        // the run goes on after the checkpoint, so its outputs do not change
+        if (checkpoint.saveAt > 0) status = runCycles(checkpoint.saveAt);
+        if (status == SUCCESS) {
+            cout << "[Simulator] Saving " << LOG_VAR(checkpoint.save) << endl;
+            if (saveCheckpoint(checkpoint.save, checkpoint.caches, checkpoint.pipeline) != SUCCESS) {
+                return ERROR;
+            }
+        } else {
+            cerr << LOG_ERROR << "The program stopped before cycle " << checkpoint.saveAt
+                 << ", no checkpoint was saved" << endl;
+            status = ERROR;
+        }
+    }
+    if (status == SUCCESS) {
+        if (sampling.region) status = runRegion();
+        else status = sampling.interval ? runSampled(sampling) : runTillHalt();
+    }
     //auto status = runCycles(10);
 
     cout << "[Simulator] Finished simulation status: " << status << endl;
@@ -5,25 +5,76 @@
  */
 
 #include <iostream>
+#include <string>
 
 #include "MemoryStore.h"
 #include "Utilities.h"
+#include "checkpoint.h"
 #include "funct.h"
 
 using namespace std;
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        cerr << LOG_ERROR << "Usage: " << argv[0] << " <input_file>" << endl;
+        cerr << LOG_ERROR << "Usage: " << argv[0]
+             << " <input_file> [--engine=block|native|check|interp] [--restore=<file>]"
+                " [--checkpoint=<file> --checkpoint-at=<instructions>]" << endl;
         return ERROR;
     }
 
+    FunctEngine engine = ENGINE_BLOCK;
+    CheckpointConfig checkpoint;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--engine=block") {
+            engine = ENGINE_BLOCK;
+        } else if (arg == "--engine=native") {
+            engine = ENGINE_NATIVE;
+        } else if (arg == "--engine=check") {
+            engine = ENGINE_CHECK;
+        } else if (arg == "--engine=interp") {
+            engine = ENGINE_INTERP;
+        } else if (arg.compare(0, 10, "--restore=") == 0) {
+            checkpoint.restore = arg.substr(10);
+        } else if (arg.compare(0, 13, "--checkpoint=") == 0) {
+            checkpoint.save = arg.substr(13);
+        } else if (arg.compare(0, 16, "--checkpoint-at=") == 0) {
+            try {
+                checkpoint.saveAt = stoull(arg.substr(16));
+            } catch (const std::exception&) {
+                cerr << LOG_ERROR << "Bad instruction count in " << arg << endl;
+                return ERROR;
+            }
+        } else {
+            cerr << LOG_ERROR << "Unknown option " << arg << endl;
+            return ERROR;
+        }
+    }
+
     cout << "[Simulator] Loading memory from " << LOG_VAR(argv[1]) << endl;
     auto baseFilename = getBaseFilename(argv[1]) + "_funct";
-    initSimulator(new MemoryStore(0, MEMORY_SIZE, argv[1]), baseFilename);
+    initSimulator(new MemoryStore(0, MEMORY_SIZE, argv[1]), baseFilename, engine);
+
+    if (!checkpoint.restore.empty()) {
+        cout << "[Simulator] Restoring " << LOG_VAR(checkpoint.restore) << endl;
+        if (restoreCheckpoint(checkpoint.restore) != SUCCESS) return ERROR;
+    }
 
     cout << "[Simulator] Start simulation" << endl;
-    auto status = runTillHalt();
+    Status status = SUCCESS;
+    if (!checkpoint.save.empty()) {
+        // the run goes on after the checkpoint, so its outputs do not change
+        if (checkpoint.saveAt > 0) status = runInstructions(checkpoint.saveAt);
+        if (status == SUCCESS) {
+            cout << "[Simulator] Saving " << LOG_VAR(checkpoint.save) << endl;
+            if (saveCheckpoint(checkpoint.save) != SUCCESS) return ERROR;
+        } else {
+            cerr << LOG_ERROR << "The program stopped before instruction " << checkpoint.saveAt
+                 << ", no checkpoint was saved" << endl;
+            status = ERROR;
+        }
+    }
+    if (status == SUCCESS) status = runTillHalt();
 
     cout << "[Simulator] Finished simulation status: " << status << endl;
     finalizeSimulator();
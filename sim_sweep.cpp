@@ -0,0 +1,312 @@
+/** Cache design-space sweep
+ * Runs one program on every point of a grid of I-cache/D-cache configurations and
+ * writes one table with the stats of each point. Each point is an independent
+ * CycleSimulator on its own copy of memory, run on a work-stealing thread pool.
+ */
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MemoryStore.h"
+#include "Utilities.h"
+#include "cache.h"
+#include "cycle.h"
+
+using namespace std;
+
+struct SweepPoint {
+    CacheConfig icConfig;
+    CacheConfig dcConfig;
+    SimulationStats stats;
+    bool halted;
+};
+
+// Each worker owns a deque of task indices. It takes work from the front of its own
+// deque and, once that is empty, steals from the back of the others.
+class WorkStealingPool {
+   private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    std::vector<Queue> queues;
+
+    bool pop(size_t worker, size_t& task) {
+        Queue& own = queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.tasks.empty()) return false;
+        task = own.tasks.front();
+        own.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(size_t thief, size_t& task) {
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(thief + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+   public:
+    explicit WorkStealingPool(size_t workers) : queues(workers) {}
+
+    // Run task(0) ... task(numTasks - 1) and return once all of them finished
+    void run(size_t numTasks, const std::function<void(size_t)>& task) {
+        for (size_t i = 0; i < numTasks; i++) queues[i % queues.size()].tasks.push_back(i);
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 0; worker < queues.size(); worker++) {
+            threads.emplace_back([this, worker, &task]() {
+                size_t next;
+                // Tasks are all queued up front, so once nothing is left to steal the
+                // worker is done
+                while (pop(worker, next) || steal(worker, next)) task(next);
+            });
+        }
+        for (auto& thread : threads) thread.join();
+    }
+};
+
+// "lru,srrip" -> {REPL_LRU, REPL_SRRIP}
+static vector<uint64_t> parsePolicyList(const string& option, const string& list) {
+    vector<uint64_t> values;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        ReplacementPolicy policy;
+        if (!parseReplacement(item, policy)) {
+            throw invalid_argument("Unknown replacement policy '" + item + "' for " + option);
+        }
+        values.push_back(policy);
+    }
+    if (values.empty()) throw invalid_argument(option + " needs at least one value");
+    return values;
+}
+
+// "1024,2048,4096" -> {1024, 2048, 4096}
+static vector<uint64_t> parseList(const string& option, const string& list) {
+    vector<uint64_t> values;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        size_t end;
+        values.push_back(stoull(item, &end));
+        if (end != item.size()) throw invalid_argument("Bad value '" + item + "' for " + option);
+    }
+    if (values.empty()) throw invalid_argument(option + " needs at least one value");
+    return values;
+}
+
+static void writeCsv(ostream& out, const vector<SweepPoint>& points) {
+    out << "ic_size,ic_block,ic_ways,ic_latency,ic_replacement,dc_size,dc_block,dc_ways,"
+           "dc_latency,dc_replacement,instructions,cycles,cpi,ic_hits,ic_misses,dc_hits,dc_misses,"
+           "dc_writebacks,dc_writethroughs,load_use_stalls,halted\n";
+    for (const auto& point : points) {
+        const CacheConfig& ic = point.icConfig;
+        const CacheConfig& dc = point.dcConfig;
+        const SimulationStats& stats = point.stats;
+        double cpi = stats.dynamicInstructions
+                         ? static_cast<double>(stats.totalCycles) / stats.dynamicInstructions
+                         : 0.0;
+        out << ic.cacheSize << ',' << ic.blockSize << ',' << ic.ways << ',' << ic.missLatency
+            << ',' << replacementName(ic.replacement) << ',' << dc.cacheSize << ','
+            << dc.blockSize << ',' << dc.ways << ',' << dc.missLatency << ','
+            << replacementName(dc.replacement) << ',' << stats.dynamicInstructions << ',' << stats.totalCycles
+            << ',' << fixed << setprecision(4) << cpi << ',' << stats.icHits << ','
+            << stats.icMisses << ',' << stats.dcHits << ',' << stats.dcMisses << ','
+            << stats.dcWritebacks << ',' << stats.dcWriteThroughs << ',' << stats.loadUseStalls
+            << ',' << (point.halted ? 1 : 0) << '\n';
+    }
+}
+
+static void writeCacheJson(ostream& out, const CacheConfig& config) {
+    out << "{\"size\": " << config.cacheSize << ", \"block\": " << config.blockSize
+        << ", \"ways\": " << config.ways << ", \"latency\": " << config.missLatency
+        << ", \"replacement\": \"" << replacementName(config.replacement) << "\"}";
+}
+
+static void writeJson(ostream& out, const vector<SweepPoint>& points) {
+    out << "[\n";
+    for (size_t i = 0; i < points.size(); i++) {
+        const SimulationStats& stats = points[i].stats;
+        double cpi = stats.dynamicInstructions
+                         ? static_cast<double>(stats.totalCycles) / stats.dynamicInstructions
+                         : 0.0;
+        out << "  {\"icache\": ";
+        writeCacheJson(out, points[i].icConfig);
+        out << ", \"dcache\": ";
+        writeCacheJson(out, points[i].dcConfig);
+        out << ", \"instructions\": " << stats.dynamicInstructions
+            << ", \"cycles\": " << stats.totalCycles << ", \"cpi\": " << fixed
+            << setprecision(4) << cpi << ", \"ic_hits\": " << stats.icHits
+            << ", \"ic_misses\": " << stats.icMisses << ", \"dc_hits\": " << stats.dcHits
+            << ", \"dc_misses\": " << stats.dcMisses
+            << ", \"dc_writebacks\": " << stats.dcWritebacks
+            << ", \"dc_writethroughs\": " << stats.dcWriteThroughs
+            << ", \"load_use_stalls\": " << stats.loadUseStalls
+            << ", \"halted\": " << (points[i].halted ? "true" : "false") << "}"
+            << (i + 1 < points.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+static void usage(const char* program) {
+    cerr << LOG_ERROR << "Usage: " << program << " <file.bin> <cache_config.txt>"
+         << " [--{ic,dc}-{size,block,ways,latency,replacement}=<v1>,<v2>,...] [--threads=<n>]"
+            " [--max-cycles=<n>] [--output=<file>.csv|.json]"
+         << endl
+         << "Every grid option replaces the corresponding value of cache_config.txt with a "
+            "list; all combinations are simulated."
+         << endl;
+    exit(ERROR);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) usage(argv[0]);
+
+    CacheConfig baseIc;
+    CacheConfig baseDc;
+    // levels below the L1s, the same for every point
+    HierarchyConfig hierarchy;
+    // grid[0..4]: I-cache size, block, ways, latency, replacement; grid[5..9]: the same
+    // for the D-cache
+    vector<uint64_t> grid[10];
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t maxCycles = 0;
+    string outputFile = getBaseFilename(argv[1]) + "_sweep.csv";
+
+    try {
+        readCacheConfigs(argv[2], baseIc, baseDc, &hierarchy);
+        grid[0] = {baseIc.cacheSize};
+        grid[1] = {baseIc.blockSize};
+        grid[2] = {baseIc.ways};
+        grid[3] = {baseIc.missLatency};
+        grid[4] = {baseIc.replacement};
+        grid[5] = {baseDc.cacheSize};
+        grid[6] = {baseDc.blockSize};
+        grid[7] = {baseDc.ways};
+        grid[8] = {baseDc.missLatency};
+        grid[9] = {baseDc.replacement};
+
+        const char* gridOptions[10] = {"--ic-size=",    "--ic-block=",       "--ic-ways=",
+                                       "--ic-latency=", "--ic-replacement=", "--dc-size=",
+                                       "--dc-block=",   "--dc-ways=",        "--dc-latency=",
+                                       "--dc-replacement="};
+        for (int i = 3; i < argc; i++) {
+            string arg = argv[i];
+            bool matched = false;
+            for (int g = 0; g < 10 && !matched; g++) {
+                string prefix = gridOptions[g];
+                if (arg.compare(0, prefix.size(), prefix) == 0) {
+                    grid[g] = g % 5 == 4 ? parsePolicyList(prefix, arg.substr(prefix.size()))
+                                         : parseList(prefix, arg.substr(prefix.size()));
+                    matched = true;
+                }
+            }
+            if (matched) continue;
+            if (arg.compare(0, 10, "--threads=") == 0) {
+                threads = static_cast<unsigned>(stoul(arg.substr(10)));
+                if (threads == 0) throw invalid_argument("--threads needs at least 1");
+            } else if (arg.compare(0, 13, "--max-cycles=") == 0) {
+                maxCycles = stoull(arg.substr(13));
+            } else if (arg.compare(0, 9, "--output=") == 0) {
+                outputFile = arg.substr(9);
+            } else {
+                throw invalid_argument("Unknown option " + arg);
+            }
+        }
+    } catch (const invalid_argument& e) {
+        cerr << LOG_ERROR << e.what() << endl;
+        usage(argv[0]);
+    } catch (const out_of_range& e) {
+        cerr << LOG_ERROR << "One of the integer arguments is out of range." << endl;
+        exit(ERROR);
+    }
+
+    // Expand the grid, dropping configurations the cache model cannot represent
+    vector<SweepPoint> points;
+    uint64_t skipped = 0;
+    size_t combinations = 1;
+    for (const auto& values : grid) combinations *= values.size();
+    for (size_t n = 0; n < combinations; n++) {
+        // n in mixed radix, the D-cache replacement varying fastest
+        uint64_t v[10];
+        size_t rest = n;
+        for (int g = 9; g >= 0; g--) {
+            v[g] = grid[g][rest % grid[g].size()];
+            rest /= grid[g].size();
+        }
+        SweepPoint point{};
+        // start from the file's configs so options not on the grid (seed) carry over
+        point.icConfig = baseIc;
+        point.dcConfig = baseDc;
+        point.icConfig.cacheSize = v[0];
+        point.icConfig.blockSize = v[1];
+        point.icConfig.ways = v[2];
+        point.icConfig.missLatency = v[3];
+        point.icConfig.replacement = static_cast<ReplacementPolicy>(v[4]);
+        point.dcConfig.cacheSize = v[5];
+        point.dcConfig.blockSize = v[6];
+        point.dcConfig.ways = v[7];
+        point.dcConfig.missLatency = v[8];
+        point.dcConfig.replacement = static_cast<ReplacementPolicy>(v[9]);
+        string error = checkHierarchyConfig(point.icConfig, point.dcConfig, hierarchy);
+        if (!error.empty()) {
+            cerr << LOG_ERROR << "Skipping " << point.icConfig << " / " << point.dcConfig << ": "
+                 << error << endl;
+            skipped++;
+            continue;
+        }
+        points.push_back(point);
+    }
+
+    cout << "[Sweep] Loading memory from " << LOG_VAR(argv[1]) << endl;
+    MemoryStore program(0, MEMORY_SIZE, argv[1]);
+
+    cout << "[Sweep] Simulating " << points.size() << " configurations (" << skipped
+         << " skipped) on " << threads << " threads" << endl;
+    std::atomic<uint64_t> unfinished{0};
+    WorkStealingPool pool(threads);
+    pool.run(points.size(), [&](size_t i) {
+        SweepPoint& point = points[i];
+        TraceConfig trace;
+        trace.mode = TRACE_OFF;
+        CycleSimulator sim(point.icConfig, point.dcConfig, new MemoryStore(program), "", trace,
+                           CoreConfig{}, hierarchy);
+        point.halted = sim.runCycles(maxCycles) == HALT;
+        point.stats = sim.getStats();
+        if (!point.halted) unfinished++;
+    });
+    if (unfinished > 0) {
+        cerr << LOG_ERROR << unfinished << " configurations hit --max-cycles before halting"
+             << endl;
+    }
+
+    ofstream out(outputFile);
+    if (!out) {
+        cerr << LOG_ERROR << "Could not open " << outputFile << endl;
+        return ERROR;
+    }
+    bool json = outputFile.size() >= 5 && outputFile.compare(outputFile.size() - 5, 5, ".json") == 0;
+    if (json) {
+        writeJson(out, points);
+    } else {
+        writeCsv(out, points);
+    }
+    cout << "[Sweep] Results written to " << outputFile << endl;
+    return SUCCESS;
+}
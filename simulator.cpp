@@ -1,17 +1,149 @@
 #include "simulator.h"
 
 #include <stdio.h>
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+
+#include "checkpoint.h"
 using namespace std;
 
 #define EXCEPTION_HANDLER 0x8000
 
+// ===== Execute dispatch =====
+// simDecode() looks the operation up once in execTable, keyed on opcode, funct3 and
+// instruction bit 30 (the funct7 bit that tells add from sub and logical from
+// arithmetic shifts). Execute and next-PC resolution are then one indirect call each.
+
+typedef uint64_t (*ExecHandler)(uint64_t a, uint64_t b, uint64_t imm, uint64_t PC);
+
+#define EXEC(name, expr) \
+    static uint64_t name(uint64_t a, uint64_t b, uint64_t imm, uint64_t PC) { return (expr); }
+
+EXEC(execNone, 0)
+EXEC(execAdd, a + b)
+EXEC(execSub, a - b)
+EXEC(execSll, a << (b & 0x3F))
+EXEC(execSlt, (int64_t)a < (int64_t)b)
+EXEC(execSltu, a < b)
+EXEC(execXor, a ^ b)
+EXEC(execSrl, a >> (b & 0x3F))
+EXEC(execSra, (int64_t)a >> (b & 0x3F))
+EXEC(execOr, a | b)
+EXEC(execAnd, a & b)
+EXEC(execAddw, sext64((uint32_t)a + (uint32_t)b, 31))
+EXEC(execSubw, sext64((uint32_t)a - (uint32_t)b, 31))
+EXEC(execSllw, sext64((uint32_t)a << (uint32_t)(b & 0x1F), 31))
+EXEC(execSrlw, sext64((uint32_t)a >> (uint32_t)(b & 0x1F), 31))
+EXEC(execSraw, sext64((int32_t)a >> (uint32_t)(b & 0x1F), 31))
+EXEC(execAddi, a + imm)
+EXEC(execSlli, a << (imm & 0x3F))
+EXEC(execSlti, (int64_t)a < (int64_t)imm)
+EXEC(execSltiu, a < imm)
+EXEC(execXori, a ^ imm)
+EXEC(execSrli, a >> (imm & 0x3F))
+EXEC(execSrai, (int64_t)a >> (imm & 0x3F))
+EXEC(execOri, a | imm)
+EXEC(execAndi, a & imm)
+EXEC(execAddiw, sext64((uint32_t)a + (uint32_t)imm, 31))
+EXEC(execSlliw, sext64((uint32_t)a << (uint32_t)(imm & 0x1F), 31))
+EXEC(execSrliw, sext64((uint32_t)a >> (uint32_t)(imm & 0x1F), 31))
+EXEC(execSraiw, sext64((int32_t)a >> (uint32_t)(imm & 0x1F), 31))
+EXEC(execLink, PC + 4)
+EXEC(execAuipc, PC + imm)
+EXEC(execLui, imm)
+
+EXEC(nextSequential, PC + 4)
+EXEC(nextBeq, a == b ? PC + imm : PC + 4)
+EXEC(nextBne, a != b ? PC + imm : PC + 4)
+EXEC(nextBlt, (int64_t)a < (int64_t)b ? PC + imm : PC + 4)
+EXEC(nextBge, (int64_t)a >= (int64_t)b ? PC + imm : PC + 4)
+EXEC(nextBltu, a < b ? PC + imm : PC + 4)
+EXEC(nextBgeu, a >= b ? PC + imm : PC + 4)
+EXEC(nextJal, PC + imm)
+EXEC(nextJalr, (a + imm) & ~1ULL)
+
+// Indexed by ExecOp
+static const ExecHandler arithHandlers[EXEC_COUNT] = {
+    execNone,
+    execAdd, execSub, execSll, execSlt, execSltu, execXor, execSrl, execSra, execOr, execAnd,
+    execAddw, execSubw, execSllw, execSrlw, execSraw,
+    execAddi, execSlli, execSlti, execSltiu, execXori, execSrli, execSrai, execOri, execAndi,
+    execAddiw, execSlliw, execSrliw, execSraiw,
+    execNone, execNone, execNone, execNone, execNone, execNone,
+    execLink, execLink, execAuipc, execLui,
+};
+
+static const ExecHandler nextPCHandlers[EXEC_COUNT] = {
+    nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential, nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential, nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential, nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential, nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential,
+    nextSequential, nextSequential, nextSequential, nextSequential,
+    nextBeq, nextBne, nextBlt, nextBge, nextBltu, nextBgeu,
+    nextJal, nextJalr, nextSequential, nextSequential,
+};
+
+// ExecOp of every (opcode, funct3, bit 30); combinations that decode rejects as
+// illegal are never looked at
+struct ExecTable {
+    ExecOp ops[32][8][2];
+
+    ExecTable() : ops{} {
+        const ExecOp intOps[8] = {EXEC_ADD, EXEC_SLL, EXEC_SLT, EXEC_SLTU,
+                                  EXEC_XOR, EXEC_SRL, EXEC_OR, EXEC_AND};
+        const ExecOp immOps[8] = {EXEC_ADDI, EXEC_SLLI, EXEC_SLTI, EXEC_SLTIU,
+                                  EXEC_XORI, EXEC_SRLI, EXEC_ORI, EXEC_ANDI};
+        for (int funct3 = 0; funct3 < 8; funct3++) {
+            set(OP_INT, funct3, intOps[funct3]);
+            set(OP_INTIMM, funct3, immOps[funct3]);
+            set(OP_JAL, funct3, EXEC_JAL);
+            set(OP_JALR, funct3, EXEC_JALR);
+            set(OP_AUIPC, funct3, EXEC_AUIPC);
+            set(OP_LUI, funct3, EXEC_LUI);
+        }
+        ops[OP_INT >> 2][FUNCT3_ADD][1] = EXEC_SUB;
+        ops[OP_INT >> 2][FUNCT3_SR][1] = EXEC_SRA;
+        ops[OP_INTIMM >> 2][FUNCT3_SR][1] = EXEC_SRAI;
+
+        set(OP_INTW, FUNCT3_ADD, EXEC_ADDW);
+        ops[OP_INTW >> 2][FUNCT3_ADD][1] = EXEC_SUBW;
+        set(OP_INTW, FUNCT3_SLL, EXEC_SLLW);
+        set(OP_INTW, FUNCT3_SR, EXEC_SRLW);
+        ops[OP_INTW >> 2][FUNCT3_SR][1] = EXEC_SRAW;
+
+        set(OP_INTIMMW, FUNCT3_ADD, EXEC_ADDIW);
+        set(OP_INTIMMW, FUNCT3_SLL, EXEC_SLLIW);
+        set(OP_INTIMMW, FUNCT3_SR, EXEC_SRLIW);
+        ops[OP_INTIMMW >> 2][FUNCT3_SR][1] = EXEC_SRAIW;
+
+        set(OP_BRANCH, FUNCT3_BEQ, EXEC_BEQ);
+        set(OP_BRANCH, FUNCT3_BNE, EXEC_BNE);
+        set(OP_BRANCH, FUNCT3_BLT, EXEC_BLT);
+        set(OP_BRANCH, FUNCT3_BGE, EXEC_BGE);
+        set(OP_BRANCH, FUNCT3_BLTU, EXEC_BLTU);
+        set(OP_BRANCH, FUNCT3_BGEU, EXEC_BGEU);
+    }
+
+    // both values of bit 30
+    void set(uint64_t opcode, int funct3, ExecOp op) {
+        ops[opcode >> 2][funct3][0] = op;
+        ops[opcode >> 2][funct3][1] = op;
+    }
+};
+
+static const ExecTable execTable;
+
 Simulator::Simulator() {
     // Initialize member variables
     memory = nullptr;
     regData.reg = {};
     din = 0;
+    decodeCache.resize(DECODE_CACHE_ENTRIES);
+    decodedLo = UINT64_MAX;
+    decodedHi = 0;
 }
 
 Simulator::~Simulator() {
@@ -46,7 +178,7 @@ Simulator::Instruction Simulator::simFetch(uint64_t PC, MemoryStore *myMem) {
 }
 
 // Determine instruction opcode, funct, reg names (but not calculate all imms)
-Simulator::Instruction Simulator::simDecode(Instruction inst) {
+void Simulator::simDecode(Instruction& inst) {
     inst.opcode = extractBits(inst.instruction, 6, 0);
     inst.rd     = extractBits(inst.instruction, 11, 7);
     inst.funct3 = extractBits(inst.instruction, 14, 12);
@@ -55,14 +187,53 @@ Simulator::Instruction Simulator::simDecode(Instruction inst) {
     inst.funct7 = extractBits(inst.instruction, 31, 25);
 
     inst.isLegal = true; // assume legal unless proven otherwise
+    inst.execOp = execTable.ops[inst.opcode >> 2][inst.funct3][extractBits(inst.instruction, 30, 30)];
+
+    // Extract the immediate once so execute does not have to
+    uint64_t imm5  = inst.rd;
+    uint64_t imm7  = inst.funct7;
+    uint64_t imm12 = extractBits(inst.instruction, 31, 20);
+    uint64_t imm20 = extractBits(inst.instruction, 31, 12);
+    switch (inst.opcode) {
+        case OP_STORE:
+            inst.imm = sext64((imm7 << 5) | imm5, 11); // S-type immediate
+            break;
+        case OP_BRANCH:
+            inst.imm = sext64(
+                extractBits(imm7, 6, 6) << 12 |
+                extractBits(imm7, 5, 0) << 5 |
+                extractBits(imm5, 4, 1) << 1 |
+                extractBits(imm5, 0, 0) << 11,
+                12); // B-type immediate
+            break;
+        case OP_AUIPC:
+        case OP_LUI:
+            inst.imm = sext64(imm20 << 12, 31); // U-type immediate
+            break;
+        case OP_JAL:
+            inst.imm = sext64(
+                extractBits(imm20, 19, 19) << 20 |
+                extractBits(imm20, 18, 9) << 1 |
+                extractBits(imm20, 8, 8) << 11 |
+                extractBits(imm20, 7, 0) << 12,
+                20); // J-type immediate
+            break;
+        default:
+            inst.imm = sext64(imm12, 11); // I-type immediate
+    }
 
     if (inst.instruction == 0xfeedfeed) {
         inst.isHalt = true;
-        return inst; // halt instruction
+        return; // halt instruction
+    }
+    if (inst.instruction == ROI_BEGIN_INSTRUCTION || inst.instruction == ROI_END_INSTRUCTION) {
+        inst.roiMarker = inst.instruction == ROI_BEGIN_INSTRUCTION ? ROI_BEGIN : ROI_END;
+        inst.execOp = EXEC_NONE;
+        return; // falls through to PC + 4
     }
     if (inst.instruction == 0x00000013) {
         inst.isNop = true;
-        return inst; // NOP instruction
+        return; // NOP instruction
     }
 
     switch (inst.opcode) {
@@ -162,252 +333,93 @@ Simulator::Instruction Simulator::simDecode(Instruction inst) {
         default:
             inst.isLegal = false;
     }
-    return inst;
 }
 
-// Collect operands whether reg or imm for arith or addr gen
-Simulator::Instruction Simulator::simOperandCollection(Instruction inst, REGS regData) {
-    regData.registers[0] = 0;
-    if (inst.readsRs1) {
-        inst.op1Val = regData.registers[inst.rs1];
-    }
-    if (inst.readsRs2) {
-        inst.op2Val = regData.registers[inst.rs2];
+// Decode through the decode cache. The raw encoding is part of the key, so an entry
+// is never used for bits that differ from what IF fetched.
+void Simulator::simDecodeCached(Instruction& inst) {
+    DecodeEntry& entry = decodeEntry(inst.PC);
+    if (entry.valid && entry.inst.PC == inst.PC && entry.inst.instruction == inst.instruction) {
+        StageStatus status = inst.status;
+        uint64_t predictedPC = inst.predictedPC;
+        inst = entry.inst;
+        inst.status = status;
+        inst.predictedPC = predictedPC;
+        return;
     }
-    return inst;
+    simDecode(inst);
+    if (inst.isLegal) cacheDecoded(inst);
 }
 
-// Resolve next PC whether +4 or branch/jump target taken/not taken
-Simulator::Instruction Simulator::simNextPCResolution(Instruction inst) {
-
-    uint64_t imm5   = inst.rd;
-    uint64_t imm7   = inst.funct7;
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    uint64_t imm20  = extractBits(inst.instruction, 31, 12);
-    uint64_t branchTarget = inst.PC + sext64(
-        extractBits(imm7, 6, 6) << 12 |
-        extractBits(imm7, 5, 0) << 5 |
-        extractBits(imm5, 4, 1) << 1 |
-        extractBits(imm5, 0, 0) << 11,
-        12); // B-type immediate 
-    uint64_t jalTarget = inst.PC + sext64(
-        extractBits(imm20, 19, 19) << 20 |
-        extractBits(imm20, 18, 9) << 1 |
-        extractBits(imm20, 8, 8) << 11 |
-        extractBits(imm20, 7, 0) << 12,
-        20); // J-type immediate
+void Simulator::cacheDecoded(const Instruction& inst) {
+    DecodeEntry& entry = decodeEntry(inst.PC);
+    entry.valid = true;
+    entry.inst = inst;
+    entry.inst.status = NORMAL;
+    decodedLo = std::min(decodedLo, inst.PC);
+    decodedHi = std::max(decodedHi, inst.PC);
+}
 
-    switch (inst.opcode) {
-        case OP_JALR:
-            inst.nextPC = (inst.op1Val + sext64(imm12, 11)) & ~1ULL;
-            break;
-        case OP_BRANCH:
-            inst.nextPC = inst.PC + 4;
-            switch (inst.funct3) {
-                case FUNCT3_BEQ:
-                    if (inst.op1Val == inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-                case FUNCT3_BNE:
-                    if (inst.op1Val != inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-                case FUNCT3_BLT:
-                    if ((int64_t)inst.op1Val < (int64_t)inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-                case FUNCT3_BGE:
-                    if ((int64_t)inst.op1Val >= (int64_t)inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-                case FUNCT3_BLTU:
-                    if (inst.op1Val < inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-                case FUNCT3_BGEU:
-                    if (inst.op1Val >= inst.op2Val) {
-                        inst.nextPC = branchTarget;
-                    }
-                    break;
-            }
-            break;
-        case OP_JAL:
-            inst.nextPC = jalTarget;
-            break;
-        default:
-            inst.nextPC = inst.PC + 4;
+// Drop every predecoded instruction overlapping [address, address + size)
+void Simulator::invalidateDecoded(uint64_t address, uint64_t size) {
+    if (address >= decodedHi + 4 || address + size + 3 <= decodedLo) return;
+    uint64_t first = address >= 3 ? address - 3 : 0;
+    for (uint64_t PC = first & ~3ULL; PC < address + size; PC += 4) {
+        DecodeEntry& entry = decodeEntry(PC);
+        if (entry.valid && entry.inst.PC + 4 > address && entry.inst.PC < address + size) {
+            entry.valid = false;
+        }
     }
+}
 
-    return inst;
+void Simulator::saveState(std::ostream& out) const {
+    putRaw(out, din);
+    putRaw(out, regData.registers);
+    memory->saveState(out);
 }
 
-// Perform arithmetic operations
-Simulator::Instruction Simulator::simArithLogic(Instruction inst) {
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    uint64_t upperImm12 = extractBits(inst.instruction, 31, 26);
-    uint64_t imm20  = extractBits(inst.instruction, 31, 12);
-    
-    if (inst.opcode == OP_INT && (
-        inst.funct3 == FUNCT3_SLL || inst.funct3 == FUNCT3_SR)) {
-        // For SLL and SR, only low 6 bits of rs2 are considered in
-        // RV64I, so we mask it to 6 bits
-        inst.op2Val &= 0x3F;
-    } else if (inst.opcode == OP_INTW && (
-        inst.funct3 == FUNCT3_SLL || inst.funct3 == FUNCT3_SR)) {
-        // For SLLW and SRW, only low 5 bits of rs2 are considered in
-        // RV64I, so we mask it to 5 bits
-        inst.op2Val &= 0x1F;
+bool Simulator::restoreState(std::istream& in) {
+    if (!getRaw(in, din) || !getRaw(in, regData.registers) || !memory->restoreState(in)) {
+        return false;
     }
+    // the predecoded copies may be of code the checkpoint overwrote
+    for (DecodeEntry& entry : decodeCache) entry.valid = false;
+    decodedLo = UINT64_MAX;
+    decodedHi = 0;
+    return true;
+}
 
-    switch (inst.opcode) {
-        case OP_INT:
-            switch (inst.funct3) {
-                case FUNCT3_ADD:
-                    if (inst.funct7 == FUNCT7_ADD) {
-                        inst.arithResult = inst.op1Val + inst.op2Val;
-                    } else if (inst.funct7 == FUNCT7_SUB) {
-                        inst.arithResult = inst.op1Val - inst.op2Val;
-                    }
-                    break;
-                case FUNCT3_SLL:
-                    inst.arithResult = inst.op1Val << inst.op2Val;
-                    break;
-                case FUNCT3_SLT:
-                    inst.arithResult = (int64_t)inst.op1Val < (int64_t)inst.op2Val;
-                    break;
-                case FUNCT3_SLTU:
-                    inst.arithResult = inst.op1Val < inst.op2Val;
-                    break;
-                case FUNCT3_XOR:
-                    inst.arithResult = inst.op1Val ^ inst.op2Val;
-                    break;
-                case FUNCT3_SR:
-                    if (upperImm12 == FUNCT7_LOGICAL) {
-                        inst.arithResult = inst.op1Val >> inst.op2Val;
-                    } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = (int64_t)inst.op1Val >> inst.op2Val;
-                    }
-                    break;
-                case FUNCT3_OR:
-                    inst.arithResult = inst.op1Val | inst.op2Val;
-                    break;
-                case FUNCT3_AND:
-                    inst.arithResult = inst.op1Val & inst.op2Val;
-                    break;
-                default:
-                    fprintf(stderr, "\tIllegal funct3\n");
-            }
-            break;
-        case OP_INTW:
-            switch (inst.funct3) {
-                case FUNCT3_ADD:
-                    if (inst.funct7 == FUNCT7_ADD) {
-                        inst.arithResult = sext64((uint32_t)inst.op1Val + (uint32_t)inst.op2Val, 31);
-                    } else if (inst.funct7 == FUNCT7_SUB) {
-                        inst.arithResult = sext64((uint32_t)inst.op1Val - (uint32_t)inst.op2Val, 31);
-                    }
-                    break;
-                case FUNCT3_SLL:
-                    inst.arithResult = sext64((uint32_t)inst.op1Val << (uint32_t)inst.op2Val, 31);
-                    break;
-                case FUNCT3_SR:
-                    if (upperImm12 == FUNCT7_LOGICAL) {
-                        inst.arithResult = sext64((uint32_t)inst.op1Val >> (uint32_t)inst.op2Val, 31);
-                    } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = sext64((int32_t)inst.op1Val >> (uint32_t)inst.op2Val, 31);
-                    }
-                    break;
-            }
-            break;
-        case OP_INTIMM:
-            switch (inst.funct3) {
-                case FUNCT3_ADD:
-                    inst.arithResult = inst.op1Val + sext64(imm12, 11);
-                    break;
-                case FUNCT3_SLL:
-                    inst.arithResult = inst.op1Val << (imm12 & 0x3F);
-                    break;
-                case FUNCT3_SLT:
-                    inst.arithResult = (int64_t)inst.op1Val < (int64_t)sext64(imm12, 11);
-                    break;
-                case FUNCT3_SLTU:
-                    inst.arithResult = inst.op1Val < sext64(imm12, 11);
-                    break;
-                case FUNCT3_XOR:
-                    inst.arithResult = inst.op1Val ^ sext64(imm12, 11);
-                    break;
-                case FUNCT3_SR:
-                    if (upperImm12 == UPPERIMM_LOGICAL) {
-                        inst.arithResult = inst.op1Val >> (imm12 & 0x3F);
-                    } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = (int64_t)inst.op1Val >> (imm12 & 0x3F);
-                    }
-                    break;
-                case FUNCT3_OR:
-                    inst.arithResult = inst.op1Val | sext64(imm12, 11);
-                    break;
-                case FUNCT3_AND:
-                    inst.arithResult = inst.op1Val & sext64(imm12, 11);
-                    break;
-            }
-            break;
-        case OP_INTIMMW:
-            switch (inst.funct3) {
-                case FUNCT3_ADD:
-                    inst.arithResult = sext64((uint32_t)inst.op1Val + (uint32_t)sext32(imm12, 11), 31);
-                    break;
-                case FUNCT3_SLL:
-                    inst.arithResult = sext64((uint32_t)inst.op1Val << (uint32_t)(imm12 & 0x1F), 31);
-                    break;
-                case FUNCT3_SR:
-                    if (upperImm12 == UPPERIMM_LOGICAL) {
-                        inst.arithResult = sext64((uint32_t)inst.op1Val >> (uint32_t)(imm12 & 0x1F), 31);
-                    } else if (upperImm12 == UPPERIMM_ARITH) {
-                        inst.arithResult = sext64((int32_t)inst.op1Val >> (uint32_t)(imm12 & 0x1F), 31);
-                    }
-                    break;
-            }
-            break;
-        case OP_JALR:
-            inst.arithResult = inst.PC + 4;
-            break;
-        case OP_AUIPC:
-            inst.arithResult = inst.PC + sext64(imm20 << 12, 31);
-            break;
-        case OP_LUI:
-            inst.arithResult = sext64(imm20 << 12, 31);
-            break;
-        case OP_JAL:
-            inst.arithResult = inst.PC + 4;
-            break;
+// Collect operands whether reg or imm for arith or addr gen
+void Simulator::simOperandCollection(Instruction& inst) {
+    // x0 reads as 0 even if a commit left a value in it
+    if (inst.readsRs1) {
+        inst.op1Val = inst.rs1 ? regData.registers[inst.rs1] : 0;
+    }
+    if (inst.readsRs2) {
+        inst.op2Val = inst.rs2 ? regData.registers[inst.rs2] : 0;
     }
+}
 
-    return inst;
+// Resolve next PC whether +4 or branch/jump target taken/not taken
+void Simulator::simNextPCResolution(Instruction& inst) {
+    inst.nextPC = nextPCHandlers[inst.execOp](inst.op1Val, inst.op2Val, inst.imm, inst.PC);
+}
+
+// Perform arithmetic operations
+void Simulator::simArithLogic(Instruction& inst) {
+    inst.arithResult = arithHandlers[inst.execOp](inst.op1Val, inst.op2Val, inst.imm, inst.PC);
 }
 
 // Generate memory address for load/store instructions
-Simulator::Instruction Simulator::simAddrGen(Instruction inst) {
-    uint64_t imm5   = inst.rd;
-    uint64_t imm7   = inst.funct7;
-    uint64_t imm12  = extractBits(inst.instruction, 31, 20);
-    int64_t storeImm = sext64((imm7 << 5) | imm5, 11); // S-type immediate
-    
-    if (inst.readsMem) {
-        inst.memAddress = inst.op1Val + sext64(imm12, 11);
-    } else if (inst.writesMem) {
-        inst.memAddress = inst.op1Val + storeImm;
+void Simulator::simAddrGen(Instruction& inst) {
+    // decode already picked the I-type (load) or S-type (store) immediate
+    if (inst.readsMem || inst.writesMem) {
+        inst.memAddress = inst.op1Val + inst.imm;
     }
-
-    return inst;
 }
 
 // Perform memory access for load/store instructions
-Simulator::Instruction Simulator::simMemAccess(Instruction inst, MemoryStore *myMem) {
+void Simulator::simMemAccess(Instruction& inst, MemoryStore *myMem) {
     MemEntrySize size = (inst.funct3 == FUNCT3_B || inst.funct3 == FUNCT3_BU) ? BYTE_SIZE :
                     (inst.funct3 == FUNCT3_H || inst.funct3 == FUNCT3_HU) ? HALF_SIZE :
                     (inst.funct3 == FUNCT3_W || inst.funct3 == FUNCT3_WU) ? WORD_SIZE : DOUBLE_SIZE;
@@ -426,80 +438,103 @@ Simulator::Instruction Simulator::simMemAccess(Instruction inst, MemoryStore *my
     } else if (inst.writesMem) {
         if (myMem->setMemValue(inst.memAddress, inst.op2Val, size) != 0) {
             inst.memException = true;
+        } else {
+            // self-modifying code: drop predecoded copies of the overwritten bytes
+            invalidateDecoded(inst.memAddress, size);
         }
     }
-
-    return inst;
 }
 
 // Write back results to registers
-Simulator::Instruction Simulator::simCommit(Instruction inst, REGS &regData) {
+void Simulator::simCommit(Instruction& inst) {
     if (inst.readsMem) {
         regData.registers[inst.rd] = inst.memResult;
     } else {
         regData.registers[inst.rd] = inst.arithResult;
     }
-    return inst;
 }
 
-// TODO complete the following pipeline stage simulation functions
-// You may find it useful to call functional simulation functions above
+// Pipeline stages work in place on the latch they are given, so the cycle simulator
+// never copies an Instruction through a call
 
-Simulator::Instruction Simulator::simIF(uint64_t PC) {
-    Instruction inst = simFetch(PC, memory);
+void Simulator::simIF(uint64_t PC, Instruction& inst) {
+    inst = simFetch(PC, memory);
     inst.status = NORMAL;
-    return inst;
 }
 
-Simulator::Instruction Simulator::simID(Simulator::Instruction inst) {
-    inst = simDecode(inst);
-    if (!inst.isLegal || inst.isHalt || inst.isNop) {
-        return inst;
-    }
-    inst = simOperandCollection(inst, regData);
-    return inst;
+void Simulator::simID(Instruction& inst) {
+    simDecodeCached(inst);
+    if (!inst.isLegal || inst.isHalt || inst.isNop) return;
+    simOperandCollection(inst);
 }
 
-Simulator::Instruction Simulator::simEX(Simulator::Instruction inst) {
-    if (!inst.isLegal || inst.isHalt || inst.isNop) return inst;
-    if (inst.doesArithLogic) inst = simArithLogic(inst);
-    if (inst.readsMem || inst.writesMem) inst = simAddrGen(inst);
-    return inst;
+void Simulator::simEX(Instruction& inst) {
+    if (!inst.isLegal || inst.isHalt || inst.isNop) return;
+    if (inst.doesArithLogic) simArithLogic(inst);
+    if (inst.readsMem || inst.writesMem) simAddrGen(inst);
 }
 
-Simulator::Instruction Simulator::simMEM(Simulator::Instruction inst) {
-    if (!inst.isLegal || inst.isHalt || inst.isNop || inst.memException) return inst;
-    if (inst.readsMem || inst.writesMem) inst = simMemAccess(inst, memory);
-    return inst;
+void Simulator::simMEM(Instruction& inst) {
+    if (!inst.isLegal || inst.isHalt || inst.isNop || inst.memException) return;
+    if (inst.readsMem || inst.writesMem) simMemAccess(inst, memory);
 }
 
-Simulator::Instruction Simulator::simWB(Simulator::Instruction inst) {
+void Simulator::simWB(Instruction& inst) {
     if (!inst.isLegal || inst.isNop || inst.status == SQUASHED || inst.status == BUBBLE ||
         inst.status == IDLE || inst.memException) {
-        return inst;
+        return;
     }
 
-    if (inst.writesRd && inst.rd != 0) inst = simCommit(inst, regData);
+    if (inst.writesRd && inst.rd != 0) simCommit(inst);
+    if (inst.roiMarker != ROI_NONE) retiredMarker = inst.roiMarker;
     din++;
-    return inst;
 }
 
 
 // Simulate the whole instruction using functions above
 Simulator::Instruction Simulator::simInstruction(uint64_t PC) {
     // Implementation moved from .cpp to .h for illustration
-    Instruction inst = simFetch(PC, memory);
-    inst = simDecode(inst);
+    Instruction inst = fetchDecoded(PC);
     inst.instructionID = din++;
     if (!inst.isLegal || inst.isHalt) return inst;
-    inst = simOperandCollection(inst, regData);
-    inst = simNextPCResolution(inst);
-    if (inst.doesArithLogic) inst = simArithLogic(inst);
+    simOperandCollection(inst);
+    simNextPCResolution(inst);
+    if (inst.doesArithLogic) simArithLogic(inst);
     if (inst.readsMem || inst.writesMem) {
-        inst = simAddrGen(inst);
-        inst = simMemAccess(inst, memory);
+        simAddrGen(inst);
+        simMemAccess(inst, memory);
     }
-    if (inst.writesRd) inst = simCommit(inst, regData);
+    if (inst.writesRd) simCommit(inst);
     PC = inst.nextPC;
     return inst;
 }
+
+Simulator::Instruction Simulator::simRetire(uint64_t PC) {
+    Instruction inst = fetchDecoded(PC);
+    if (!inst.isLegal) return inst;
+    inst.instructionID = din;
+    if (!inst.isHalt) {
+        simOperandCollection(inst);
+        simNextPCResolution(inst);
+        if (inst.doesArithLogic) simArithLogic(inst);
+        if (inst.readsMem || inst.writesMem) {
+            simAddrGen(inst);
+            simMemAccess(inst, memory);
+            if (inst.memException) return inst;
+        }
+        if (inst.writesRd && inst.rd != 0) simCommit(inst);
+        if (inst.roiMarker != ROI_NONE) retiredMarker = inst.roiMarker;
+    }
+    din += !inst.isNop;
+    return inst;
+}
+
+// Stores invalidate overwritten entries, so a hit can skip fetch and decode
+Simulator::Instruction Simulator::fetchDecoded(uint64_t PC) {
+    DecodeEntry& entry = decodeEntry(PC);
+    if (entry.valid && entry.inst.PC == PC) return entry.inst;
+    Instruction inst = simFetch(PC, memory);
+    simDecode(inst);
+    if (inst.isLegal) cacheDecoded(inst);
+    return inst;
+}
@@ -1,12 +1,36 @@
 #pragma once
 
+#include <istream>
+#include <ostream>
 #include <string>
+#include <vector>
 
 #include "Utilities.h"
 #include "MemoryStore.h"
 #include "RegisterInfo.h"
 
+// Number of entries in the predecoded instruction cache (must be a power of 2)
+#define DECODE_CACHE_ENTRIES 2048
+
+// Operation selected once by simDecode(); indexes the execute and next-PC handler tables
+enum ExecOp : uint8_t {
+    EXEC_NONE,  // loads, stores: no ALU result, falls through to PC + 4
+    EXEC_ADD, EXEC_SUB, EXEC_SLL, EXEC_SLT, EXEC_SLTU, EXEC_XOR, EXEC_SRL, EXEC_SRA, EXEC_OR, EXEC_AND,
+    EXEC_ADDW, EXEC_SUBW, EXEC_SLLW, EXEC_SRLW, EXEC_SRAW,
+    EXEC_ADDI, EXEC_SLLI, EXEC_SLTI, EXEC_SLTIU, EXEC_XORI, EXEC_SRLI, EXEC_SRAI, EXEC_ORI, EXEC_ANDI,
+    EXEC_ADDIW, EXEC_SLLIW, EXEC_SRLIW, EXEC_SRAIW,
+    EXEC_BEQ, EXEC_BNE, EXEC_BLT, EXEC_BGE, EXEC_BLTU, EXEC_BGEU,
+    EXEC_JAL, EXEC_JALR, EXEC_AUIPC, EXEC_LUI,
+    EXEC_COUNT
+};
+
+// Region-of-interest marker an instruction is, see ROI_BEGIN_INSTRUCTION
+enum RoiMarker : uint8_t { ROI_NONE, ROI_BEGIN, ROI_END };
+
 class Simulator {
+    // translates blocks of instructions and runs them directly on regData/memory
+    friend class BlockEngine;
+
    private:
     union REGS {
         RegisterInfo reg;
@@ -20,20 +44,28 @@ class Simulator {
 
     // Arch states and statistics
     uint64_t din;  // Dynamic instruction number
+    RoiMarker retiredMarker = ROI_NONE;  // last ROI marker simWB() retired
 
    public:
     Simulator();
     ~Simulator();
 
+    // Hot fields (everything a cycle reads or writes) come first and use the narrowest
+    // types, so a latch spans two cache lines; instructionID is only set by
+    // simInstruction()
     struct Instruction {
         // known by IF
         uint64_t PC = 0;
-        uint64_t instruction = 0;    // raw instruction encoding
+        uint32_t instruction = 0;    // raw instruction encoding
+
+        // Used for stage status tracking in cycle
+        StageStatus status = NORMAL;
 
         // known by ID
         bool     isHalt = false;
         bool     isLegal = false;
         bool     isNop = false;
+        RoiMarker roiMarker = ROI_NONE;  // legal, but does nothing else
 
         bool     readsMem = false;
         bool     writesMem = false;
@@ -41,20 +73,22 @@ class Simulator {
         bool     writesRd = false;
         bool     readsRs1 = false;
         bool     readsRs2 = false;
+        ExecOp   execOp = EXEC_NONE;  // operation of a legal instruction
 
-        uint64_t opcode = 0;
-        uint64_t funct3 = 0;
-        uint64_t funct7 = 0;
-        uint64_t rd = 0;
-        uint64_t rs1 = 0;
-        uint64_t rs2 = 0;
+        uint8_t  opcode = 0;
+        uint8_t  funct3 = 0;
+        uint8_t  funct7 = 0;
+        uint8_t  rd = 0;
+        uint8_t  rs1 = 0;
+        uint8_t  rs2 = 0;
+        uint64_t imm = 0;            // sign-extended immediate of the instruction's format
 
         uint64_t nextPC = 0;
+        uint64_t predictedPC = 0;    // PC the cycle model fetched after this one (set by IF)
 
         uint64_t op1Val = 0;
         uint64_t op2Val = 0;
 
-
         // known by EX
         uint64_t arithResult = 0;
         uint64_t memAddress = 0;
@@ -62,41 +96,72 @@ class Simulator {
         // known by MEM
         bool     memException = false;
         uint64_t memResult = 0;
-        uint64_t valToWrite = 0;
 
         // known by WB
         uint64_t instructionID = 0;  // din of the instruction
+    };
 
-        // Used for stage status tracking in cycle
-        StageStatus status = NORMAL;
+   private:
+    // Predecoded instructions, direct-mapped on the PC
+    struct DecodeEntry {
+        bool valid = false;
+        Instruction inst;
     };
+    std::vector<DecodeEntry> decodeCache;
+    // Lowest and highest PC currently in the decode cache, so that stores to data
+    // can skip the invalidation check
+    uint64_t decodedLo;
+    uint64_t decodedHi;
+
+    DecodeEntry& decodeEntry(uint64_t PC) {
+        return decodeCache[(PC >> 2) & (DECODE_CACHE_ENTRIES - 1)];
+    }
+    void cacheDecoded(const Instruction& inst);
+    void invalidateDecoded(uint64_t address, uint64_t size);
+    // Fetch and decode the instruction at PC, or take it from the decode cache
+    Instruction fetchDecoded(uint64_t PC);
 
+   public:
     // getters and setters
     auto getDin() { return din; }
     auto getMemory() { return memory; }
+    uint64_t getReg(uint64_t reg) const { return regData.registers[reg]; }
+    RoiMarker getRetiredMarker() const { return retiredMarker; }
+    void clearRetiredMarker() { retiredMarker = ROI_NONE; }
 
     void setMemory(MemoryStore* mem) { memory = mem; }
 
-    // Simulate by functionality (project 1)
+    // Simulate by functionality (project 1); all but simFetch() update inst in place
     Instruction simFetch(uint64_t PC, MemoryStore *myMem);
-    Instruction simDecode(Instruction inst);
-    Instruction simOperandCollection(Instruction inst, REGS regData);
-    Instruction simNextPCResolution(Instruction inst);
-    Instruction simArithLogic(Instruction inst);
-    Instruction simAddrGen(Instruction inst);
-    Instruction simMemAccess(Instruction inst, MemoryStore *myMem);
-    Instruction simCommit(Instruction inst, REGS &regData);
+    void simDecode(Instruction& inst);
+    // simDecode through the decode cache, keyed on PC and raw encoding
+    void simDecodeCached(Instruction& inst);
+    void simOperandCollection(Instruction& inst);
+    void simNextPCResolution(Instruction& inst);
+    void simArithLogic(Instruction& inst);
+    void simAddrGen(Instruction& inst);
+    void simMemAccess(Instruction& inst, MemoryStore *myMem);
+    void simCommit(Instruction& inst);
 
     // Simulate an instruction functionally in a single step
     Instruction simInstruction(uint64_t PC);
+    // simInstruction() as simWB() retires it: nops are not counted, and an illegal
+    // instruction or a memory fault changes nothing and is left to the caller to trap
+    Instruction simRetire(uint64_t PC);
 
-    // Simulate pipeline stages (project 2 TODO)
-    Instruction simIF(uint64_t PC);
-    Instruction simID(Instruction inst);
-    Instruction simEX(Instruction inst);
-    Instruction simMEM(Instruction inst);
-    Instruction simWB(Instruction inst);
+    // Simulate pipeline stages on a latch in place (project 2)
+    void simIF(uint64_t PC, Instruction& inst);
+    void simID(Instruction& inst);
+    void simEX(Instruction& inst);
+    void simMEM(Instruction& inst);
+    void simWB(Instruction& inst);
 
     // Helper function to dump registers and memory
     void dumpRegMem(const std::string& output_name);
+
+    // Write din, the registers and memory to a checkpoint, or read them back; the
+    // caller keeps the PC
+    void saveState(std::ostream& out) const;
+    // @return false if the checkpoint's memory has another size
+    bool restoreState(std::istream& in);
 };
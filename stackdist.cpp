@@ -0,0 +1,106 @@
+#include "stackdist.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+StackDistanceProfiler::StackDistanceProfiler(uint64_t blockSize, uint64_t maxSets,
+                                             uint64_t maxWays)
+    : blockSize(blockSize), blockBits(0), maxWays(maxWays) {
+    while ((1ULL << blockBits) < blockSize) blockBits++;
+    for (uint64_t sets = 1; sets <= maxSets; sets <<= 1) {
+        Level level;
+        level.sets = sets;
+        level.stacks.resize(sets);
+        level.hitsAtDepth.resize(maxWays, 0);
+        levels.push_back(std::move(level));
+    }
+}
+
+void StackDistanceProfiler::access(uint64_t address) {
+    accesses++;
+    uint64_t block = address >> blockBits;
+    for (Level& level : levels) {
+        std::vector<uint64_t>& stack = level.stacks[block & (level.sets - 1)];
+        auto found = std::find(stack.begin(), stack.end(), block);
+        if (found != stack.end()) {
+            level.hitsAtDepth[found - stack.begin()]++;
+            // move to the top, shifting the more recent blocks down by one
+            std::rotate(stack.begin(), found, found + 1);
+        } else {
+            // deeper than any tracked associativity: a miss for all of them
+            if (stack.size() < maxWays) stack.push_back(block);
+            else stack.back() = block;
+            std::rotate(stack.begin(), stack.end() - 1, stack.end());
+        }
+    }
+}
+
+void StackDistanceProfiler::resetStats() {
+    accesses = 0;
+    for (Level& level : levels) std::fill(level.hitsAtDepth.begin(), level.hitsAtDepth.end(), 0);
+}
+
+uint64_t StackDistanceProfiler::misses(uint64_t sets, uint64_t ways) const {
+    for (const Level& level : levels) {
+        if (level.sets != sets) continue;
+        uint64_t hits = 0;
+        for (uint64_t depth = 0; depth < ways && depth < maxWays; depth++) {
+            hits += level.hitsAtDepth[depth];
+        }
+        return accesses - hits;
+    }
+    return accesses;
+}
+
+void StackDistanceProfiler::writeCurve(const std::string& name, std::ostream& out) const {
+    for (const Level& level : levels) {
+        for (uint64_t ways = 1; ways <= maxWays; ways <<= 1) {
+            uint64_t missCount = misses(level.sets, ways);
+            double ratio = accesses ? static_cast<double>(missCount) / accesses : 0.0;
+            out << name << ',' << blockSize << ',' << level.sets << ',' << ways << ','
+                << level.sets * ways * blockSize << ',' << accesses << ',' << missCount << ','
+                << std::fixed << std::setprecision(6) << ratio << '\n';
+        }
+    }
+}
+
+MissClassifier::MissClassifier(uint64_t cacheSize, uint64_t blockSize)
+    : blockBits(0), capacity(cacheSize / blockSize) {
+    while ((1ULL << blockBits) < blockSize) blockBits++;
+}
+
+void MissClassifier::access(uint64_t address, bool miss) {
+    uint64_t block = address >> blockBits;
+    bool first = seen.insert(block).second;
+    auto found = where.find(block);
+    bool shadowHit = found != where.end();
+    if (shadowHit) {
+        lru.splice(lru.begin(), lru, found->second);
+    } else {
+        if (lru.size() == capacity) {
+            where.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(block);
+        where[block] = lru.begin();
+    }
+
+    if (!miss) return;
+    if (first) compulsory++;
+    else if (!shadowHit) capacityMisses++;
+    else conflict++;
+}
+
+Status dumpMissCurves(const StackDistanceProfiler& iProfile,
+                      const StackDistanceProfiler& dProfile, const std::string& base_output_name) {
+    std::ofstream curve_out(base_output_name + "_miss_curve.csv");
+    if (!curve_out) {
+        std::cerr << LOG_ERROR << "Could not create miss curve file" << std::endl;
+        return ERROR;
+    }
+    curve_out << "cache,block,sets,ways,size,accesses,misses,miss_ratio\n";
+    iProfile.writeCurve("icache", curve_out);
+    dProfile.writeCurve("dcache", curve_out);
+    return SUCCESS;
+}
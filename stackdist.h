@@ -0,0 +1,86 @@
+#pragma once
+#include <inttypes.h>
+
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Utilities.h"
+
+// Largest number of sets and ways a profile covers (powers of 2 from 1 up)
+#define STACK_DIST_MAX_SETS 4096
+#define STACK_DIST_MAX_WAYS 16
+
+// Mattson stack-distance profile of one cache's address stream. For a fixed block
+// size it keeps the LRU stack of every set for each power-of-two number of sets and
+// counts at which depth each access finds its block. A true-LRU cache with W ways
+// hits exactly on the accesses found above depth W, so one pass gives the misses of
+// every sets x ways geometry at this block size.
+class StackDistanceProfiler {
+   private:
+    struct Level {
+        uint64_t sets;
+        // stacks[set], most recently used block first, at most maxWays deep
+        std::vector<std::vector<uint64_t>> stacks;
+        // hitsAtDepth[d]: accesses that found their block at stack depth d
+        std::vector<uint64_t> hitsAtDepth;
+    };
+
+    uint64_t blockSize;
+    uint64_t blockBits;
+    uint64_t maxWays;
+    uint64_t accesses = 0;
+    std::vector<Level> levels;
+
+   public:
+    StackDistanceProfiler(uint64_t blockSize, uint64_t maxSets = STACK_DIST_MAX_SETS,
+                          uint64_t maxWays = STACK_DIST_MAX_WAYS);
+
+    void access(uint64_t address);
+
+    // Forget the counts, keeping the stacks
+    void resetStats();
+
+    uint64_t getAccesses() const { return accesses; }
+    uint64_t getBlockSize() const { return blockSize; }
+
+    // misses of an LRU cache with the given power-of-two geometry
+    uint64_t misses(uint64_t sets, uint64_t ways) const;
+
+    /** Write the miss-ratio curve as CSV rows
+     * "<name>,<block>,<sets>,<ways>,<size>,<accesses>,<misses>,<miss ratio>"
+     * for every sets x ways combination, without a header
+     */
+    void writeCurve(const std::string& name, std::ostream& out) const;
+};
+
+// Sorts the misses of one cache into the three Cs. Its access stream also runs through
+// an infinite tag set and a fully associative LRU cache of the same capacity: a miss on
+// a block never seen before is compulsory, one the fully associative cache misses too
+// is a capacity miss, and the rest are conflict misses.
+class MissClassifier {
+   private:
+    uint64_t blockBits;
+    uint64_t capacity;  // in blocks
+    std::unordered_set<uint64_t> seen;
+    // the shadow cache, most recently used block first
+    std::list<uint64_t> lru;
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> where;
+
+   public:
+    uint64_t compulsory = 0;
+    uint64_t capacityMisses = 0;
+    uint64_t conflict = 0;
+
+    MissClassifier(uint64_t cacheSize, uint64_t blockSize);
+
+    // Observe one access; miss says whether the real cache missed
+    void access(uint64_t address, bool miss);
+};
+
+// Write <base>_miss_curve.csv with the curves of the I-cache and D-cache streams
+Status dumpMissCurves(const StackDistanceProfiler& iProfile,
+                      const StackDistanceProfiler& dProfile, const std::string& base_output_name);
@@ -0,0 +1,31 @@
+.section .text
+.globl _start
+_start:
+    # startup: fill 64 words at 0x1000 with 0, 1, 2, ...
+    li   t0, 0x1000
+    li   t1, 0
+    li   t2, 64
+init:
+    sw   t1, 0(t0)
+    addi t0, t0, 4
+    addi t1, t1, 1
+    bne  t1, t2, init
+
+    # --roi counts 324 instructions (3 + 64 * 5 + the ROI end) and 64 D-cache accesses
+    # with --width=2/4 and --ooo. The scalar pipeline counts more: it runs an instruction
+    # held in ID during an I-cache miss again each cycle
+    .word 0xfeedf00d      # ROI begin
+    li   t0, 0x1000
+    li   t1, 0
+    li   t3, 0
+sum:
+    lw   t4, 0(t0)        # load-use on every iteration
+    add  t3, t3, t4
+    addi t0, t0, 4
+    addi t1, t1, 1
+    bne  t1, t2, sum
+    .word 0xfeedd0ed      # ROI end
+
+    # the sum (2016) goes after the array
+    sw   t3, 0(t0)
+    .word 0xfeedfeed
@@ -0,0 +1,21 @@
+.section .text
+.globl _start
+_start:
+    li   t1, 0
+base:
+    auipc t0, 0               # t0 = address of base; patched is at +44, replacement at +52
+    jal  ra, patched          # t1 = 1
+    lw   t2, 52(t0)
+    sw   t2, 44(t0)
+    nop                       # no fence.i: let the store reach memory before the refetch
+    nop
+    nop
+    nop
+    mv   t4, t1
+    jal  ra, patched          # t1 = 16 if the new encoding ran, 1 if a stale decode did
+    .word 0xfeedfeed
+patched:
+    addi t1, zero, 1          # rewritten to addi t1, zero, 16 after the first call
+    ret
+replacement:
+    addi t1, zero, 16
@@ -0,0 +1,18 @@
+.section .text
+.globl _start
+_start:
+    li   t1, 0
+base:
+    auipc t0, 0               # t0 = address of base; patched is at +44
+    jal  ra, patched
+    li   t2, 0x40
+    sb   t2, 46(t0)           # byte 2 of ret: jalr zero, 0(ra) becomes jalr zero, 4(ra)
+    nop                       # no fence.i: let the store reach memory before the refetch
+    nop
+    nop
+    nop
+    jal  ra, patched          # the new encoding returns past the li
+    li   t1, 1                # t1 = 0 if the new encoding ran, 1 if a stale decode did
+    .word 0xfeedfeed
+patched:
+    ret                       # the last instruction decoded, so the highest cached PC